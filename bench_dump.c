@@ -0,0 +1,69 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "libnl_getlink.h"
+#include "nlgen.h"
+#include "syslog.h"
+
+/* dump engine scaling benchmark: synthetic RTM_NEWLINK dumps of 10k, 50k and
+ * 100k links are fed through nl_dump_feed() into a netdev_table_t */
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int main(int argc, char **argv) {
+  static const int sizes[] = {10000, 50000, 100000};
+  int rounds = argc > 1 ? atoi(argv[1]) : 5;
+  double base = 0;
+
+  setup_syslog2(LOG_NOTICE, false);
+
+  nl_ctx_t ctx;
+  if (nl_ctx_open(&ctx)) return -1;
+
+  printf("%8s %10s %10s %12s %8s\n", "links", "best ms", "ns/link", "table count", "scale");
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    int nlinks = sizes[s];
+    uint64_t best = UINT64_MAX;
+    size_t count = 0;
+
+    for (int r = 0; r < rounds; r++) {
+      nlgen_opts_t opts = {.nlinks = nlinks, .bridges = 64};
+      nlgen_chunk_t *chunks;
+      netdev_table_t table;
+      size_t nchunks = nlgen_dump(&opts, &chunks);
+      if (!nchunks) return -1;
+      /* the next request gets seq + 1, stamp the synthetic reply with it */
+      nlgen_stamp(chunks, nchunks, ctx.seq + 1, ctx.pid);
+
+      if (netdev_table_init(&table) || nl_dump_start(&ctx, &table, NULL, NULL)) return -1;
+      uint64_t t0 = now_ns();
+      int status = 0;
+      for (size_t i = 0; i < nchunks && status == 0; i++) {
+        status = nl_dump_feed(&ctx, chunks[i].buf, chunks[i].len);
+      }
+      uint64_t t = now_ns() - t0;
+      if (status != 1) {
+        fprintf(stderr, "synthetic dump did not complete: %d\n", status);
+        return -1;
+      }
+
+      if (t < best) best = t;
+      count = table.count;
+      netdev_table_free(&table);
+      nlgen_free(chunks, nchunks);
+    }
+
+    double per_link = (double)best / nlinks;
+    if (!base) base = per_link;
+    printf("%8d %10.2f %10.1f %12zu %8.2f\n", nlinks, best / 1e6, per_link, count, per_link / base);
+  }
+
+  nl_ctx_close(&ctx);
+  return 0;
+}
@@ -0,0 +1,111 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libnl_getlink.h"
+#include "mactab.h"
+#include "syslog.h"
+
+/* batch MAC -> ifindex lookup: each mactab loop against one hashed
+ * netdev_table_get_by_mac() per query, half the queries miss */
+
+#define QUERIES 65536
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void random_mac(uint8_t *mac, unsigned int *seed) {
+  for (int i = 0; i < ETH_ALEN; i++) mac[i] = rand_r(seed);
+  mac[0] = (mac[0] & 0xfe) | 0x02; /* locally administered unicast */
+}
+
+static int fill_table(netdev_table_t *table, int n, unsigned int *seed) {
+  if (netdev_table_init(table)) return -1;
+  for (int i = 0; i < n; i++) {
+    netdev_item_t *dev = netdev_table_alloc(table);
+    if (!dev) return -1;
+    memset(dev, 0, sizeof(*dev));
+    dev->index = i + 1;
+    snprintf(dev->name, sizeof(dev->name), "eth%d", i);
+    do random_mac(dev->ll_addr, seed);
+    while (netdev_table_get_by_mac(table, dev->ll_addr));
+    netdev_table_add(table, dev);
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  static const int sizes[] = {16, 64, 256, 1024};
+  static const netdev_mac_impl_t impls[] = {NETDEV_MAC_SCALAR, NETDEV_MAC_SSE2, NETDEV_MAC_AVX2};
+  int rounds = argc > 1 ? atoi(argv[1]) : 5;
+  unsigned int seed = 1;
+
+  setup_syslog2(LOG_NOTICE, false);
+
+  uint8_t (*macs)[ETH_ALEN] = malloc(QUERIES * sizeof(*macs));
+  int *out = malloc(QUERIES * sizeof(*out));
+  int *want = malloc(QUERIES * sizeof(*want));
+  if (!macs || !out || !want) return -1;
+
+  printf("%6s %-8s %10s\n", "links", "lookup", "ns/mac");
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    netdev_table_t table;
+    netdev_mactab_t tab;
+    if (fill_table(&table, sizes[s], &seed) || netdev_mactab_build(&tab, &table)) return -1;
+
+    /* every other query is a device MAC, the rest most likely nobody's */
+    netdev_item_t **devs = malloc(sizes[s] * sizeof(*devs));
+    netdev_item_t *item;
+    int n = 0;
+    slist_for_each_entry(item, &table.list, list) devs[n++] = item;
+    for (int q = 0; q < QUERIES; q++) {
+      if (q & 1) {
+        random_mac(macs[q], &seed);
+      } else {
+        memcpy(macs[q], devs[rand_r(&seed) % n]->ll_addr, ETH_ALEN);
+      }
+    }
+    free(devs);
+
+    uint64_t best = UINT64_MAX;
+    for (int r = 0; r < rounds; r++) {
+      uint64_t t0 = now_ns();
+      for (int q = 0; q < QUERIES; q++) {
+        netdev_item_t *dev = netdev_table_get_by_mac(&table, macs[q]);
+        want[q] = dev ? dev->index : 0;
+      }
+      uint64_t ns = now_ns() - t0;
+      if (ns < best) best = ns;
+    }
+    printf("%6d %-8s %10.1f\n", sizes[s], "hash", (double)best / QUERIES);
+
+    for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+      if (netdev_mactab_use(impls[i])) continue;
+      best = UINT64_MAX;
+      for (int r = 0; r < rounds; r++) {
+        uint64_t t0 = now_ns();
+        netdev_mactab_lookup(&tab, (const uint8_t(*)[ETH_ALEN])macs, QUERIES, out);
+        uint64_t ns = now_ns() - t0;
+        if (ns < best) best = ns;
+      }
+      if (memcmp(out, want, QUERIES * sizeof(*out))) {
+        fprintf(stderr, "%s lookup disagrees with the table\n", netdev_mactab_impl_name());
+        return -1;
+      }
+      printf("%6d %-8s %10.1f\n", sizes[s], netdev_mactab_impl_name(), (double)best / QUERIES);
+    }
+
+    netdev_mactab_free(&tab);
+    netdev_table_free(&table);
+  }
+
+  free(macs);
+  free(out);
+  free(want);
+  return 0;
+}
@@ -0,0 +1,178 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libnl_getlink.h"
+#include "nlgen.h"
+#include "syslog.h"
+
+/* microbenchmark suite on synthetic dumps: parse only, slist build, indexed
+ * table build, lookups and teardown, in ns and allocations per device */
+
+/* count allocations by wrapping the libc allocator */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static size_t nallocs;
+
+void *malloc(size_t size) {
+  nallocs++;
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+  nallocs++;
+  return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+  nallocs++;
+  return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+  __libc_free(ptr);
+}
+
+enum { PH_PARSE, PH_LIST, PH_LIST_FREE, PH_TABLE, PH_LOOKUP, PH_TABLE_FREE, PH_MAX };
+
+static const char *phase_name[PH_MAX] = {"parse", "list build", "list free", "table build", "lookup x3", "table free"};
+
+typedef struct result {
+  uint64_t ns;
+  size_t allocs;
+} result_t;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int count_visit(const netdev_item_t *dev, const struct nlmsghdr *nh, void *arg) {
+  if (dev) (*(size_t *)arg)++;
+  return 0;
+}
+
+/* feed a prepared dump to the request just started on ctx */
+static int feed(nl_ctx_t *ctx, nlgen_chunk_t *chunks, size_t nchunks) {
+  int status = 0;
+  nlgen_stamp(chunks, nchunks, ctx->seq, ctx->pid);
+  for (size_t i = 0; i < nchunks && status == 0; i++) {
+    status = nl_dump_feed(ctx, chunks[i].buf, chunks[i].len);
+  }
+  return status == 1 ? 0 : -1;
+}
+
+static void take(result_t *best, uint64_t t0, size_t a0) {
+  uint64_t t = now_ns() - t0;
+  size_t a = nallocs - a0;
+  if (!best->ns || t < best->ns) best->ns = t;
+  best->allocs = a;
+}
+
+static int run(nl_ctx_t *ctx, const nlgen_opts_t *opts, int rounds, result_t *res) {
+  nlgen_chunk_t *chunks;
+  size_t nchunks = nlgen_dump(opts, &chunks);
+  if (!nchunks) return -1;
+
+  int n = opts->nlinks;
+  int *keys = malloc(n * sizeof(*keys));
+  char (*names)[IFNAMSIZ + 1] = malloc(n * sizeof(*names));
+  uint8_t (*macs)[ETH_ALEN] = malloc(n * sizeof(*macs));
+  memset(res, 0, PH_MAX * sizeof(*res));
+
+  for (int r = 0; r < rounds; r++) {
+    uint64_t t0;
+    size_t a0, parsed = 0;
+
+    if (nl_dump_start_each(ctx, NULL, count_visit, &parsed)) return -1;
+    t0 = now_ns(), a0 = nallocs;
+    if (feed(ctx, chunks, nchunks) || parsed != (size_t)n) return -1;
+    take(&res[PH_PARSE], t0, a0);
+
+    /* plain slist as get_netdev() builds it: one calloc() per device */
+    netdev_table_t list = {0};
+    if (nl_dump_start(ctx, &list, NULL, NULL)) return -1;
+    t0 = now_ns(), a0 = nallocs;
+    if (feed(ctx, chunks, nchunks)) return -1;
+    take(&res[PH_LIST], t0, a0);
+    t0 = now_ns(), a0 = nallocs;
+    free_netdev_list(&list.list);
+    take(&res[PH_LIST_FREE], t0, a0);
+
+    netdev_table_t table;
+    t0 = now_ns(), a0 = nallocs;
+    if (netdev_table_init(&table) || nl_dump_start(ctx, &table, NULL, NULL)) return -1;
+    if (feed(ctx, chunks, nchunks)) return -1;
+    take(&res[PH_TABLE], t0, a0);
+
+    /* keys in a shuffled order so lookups do not walk memory linearly */
+    netdev_item_t *item;
+    int i = 0;
+    slist_for_each_entry(item, &table.list, list) {
+      int j = (int)((uint64_t)i * 2654435761u % (uint64_t)n);
+      keys[j] = item->index;
+      memcpy(names[j], item->name, sizeof(names[j]));
+      memcpy(macs[j], item->ll_addr, ETH_ALEN);
+      i++;
+    }
+    size_t found = 0;
+    t0 = now_ns(), a0 = nallocs;
+    for (i = 0; i < n; i++) {
+      found += netdev_table_get_by_index(&table, keys[i]) != NULL;
+      found += netdev_table_get_by_name(&table, names[i]) != NULL;
+      found += netdev_table_get_by_mac(&table, macs[i]) != NULL;
+    }
+    take(&res[PH_LOOKUP], t0, a0);
+    if (found != 3 * (size_t)n) return -1;
+
+    t0 = now_ns(), a0 = nallocs;
+    netdev_table_free(&table);
+    take(&res[PH_TABLE_FREE], t0, a0);
+  }
+
+  free(keys);
+  free(names);
+  free(macs);
+  nlgen_free(chunks, nchunks);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  static const int sizes[] = {1000, 10000, 100000};
+  int rounds = argc > 1 ? atoi(argv[1]) : 5;
+  int num_vf = argc > 2 ? atoi(argv[2]) : 0;
+  if (num_vf < 0 || num_vf > NLGEN_VF_MAX) {
+    fprintf(stderr, "usage: %s [rounds] [VFs per veth, 0..%d]\n", argv[0], NLGEN_VF_MAX);
+    return -1;
+  }
+
+  setup_syslog2(LOG_NOTICE, false);
+
+  nl_ctx_t ctx;
+  if (nl_ctx_open(&ctx)) return -1;
+  nl_ctx_set_fields(&ctx, NETDEV_F_MTU | NETDEV_F_OPERSTATE | NETDEV_F_FLAGS | NETDEV_F_TXQLEN | (num_vf ? NETDEV_F_VF : 0));
+
+  printf("synthetic dumps: 64 bridges, 25%% vlans, veth pairs, %d VFs per veth\n", num_vf);
+  printf("%8s %-12s %10s %12s\n", "links", "phase", "ns/dev", "allocs/dev");
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    nlgen_opts_t opts = {.nlinks = sizes[s], .bridges = 64, .vlan_pct = 25, .num_vf = num_vf};
+    result_t res[PH_MAX];
+
+    if (run(&ctx, &opts, rounds, res)) {
+      fprintf(stderr, "synthetic dump of %d links failed\n", sizes[s]);
+      return -1;
+    }
+    for (int p = 0; p < PH_MAX; p++) {
+      printf("%8d %-12s %10.1f %12.3f\n", sizes[s], phase_name[p], (double)res[p].ns / sizes[s], (double)res[p].allocs / sizes[s]);
+    }
+  }
+
+  nl_ctx_close(&ctx);
+  return 0;
+}
@@ -0,0 +1,333 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "export.h"
+#include "syslog.h"
+
+#include "leak_detector_c.h"
+
+/* most one device can take in any format, the buffer is flushed before a
+ * device that might not fit */
+#define EXPORT_RECORD_MAX 1024
+
+static const char *field_names[EXPORT_F_MAX] = {
+    "index", "name", "kind", "mac", "master", "master_name", "link",
+    "link_name", "bridge", "mtu", "flags", "operstate", "txqlen",
+};
+
+static const char hex[] = "0123456789abcdef";
+
+static int write_all(int fd, const char *p, size_t len) {
+  while (len) {
+    ssize_t n = write(fd, p, len);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+static char *put_u32(char *p, uint32_t v) {
+  char tmp[10];
+  int n = 0;
+  do {
+    tmp[n++] = '0' + v % 10;
+    v /= 10;
+  } while (v);
+  while (n) *p++ = tmp[--n];
+  return p;
+}
+
+static char *put_i32(char *p, int32_t v) {
+  if (v < 0) {
+    *p++ = '-';
+    return put_u32(p, -(uint32_t)v);
+  }
+  return put_u32(p, v);
+}
+
+static char *put_mem(char *p, const char *s, size_t len) {
+  memcpy(p, s, len);
+  return p + len;
+}
+
+#define put_lit(p, s) put_mem(p, s, sizeof(s) - 1)
+
+static char *put_mac(char *p, const uint8_t *mac) {
+  for (int i = 0; i < ETH_ALEN; i++) {
+    if (i) *p++ = ':';
+    *p++ = hex[mac[i] >> 4];
+    *p++ = hex[mac[i] & 0xf];
+  }
+  return p;
+}
+
+/* quoted JSON string, NULL is null */
+static char *put_json_str(char *p, const char *s) {
+  if (!s) return put_lit(p, "null");
+  *p++ = '"';
+  for (; *s; s++) {
+    unsigned char c = *s;
+    if (c == '"' || c == '\\') {
+      *p++ = '\\';
+      *p++ = c;
+    } else if (c < 0x20) {
+      p = put_lit(p, "\\u00");
+      *p++ = hex[c >> 4];
+      *p++ = hex[c & 0xf];
+    } else {
+      *p++ = c;
+    }
+  }
+  *p++ = '"';
+  return p;
+}
+
+char *export_json_str(char *buf, const char *s) {
+  *put_json_str(buf, s) = '\0';
+  return buf;
+}
+
+/* CSV field, quoted only when it has to be */
+static char *put_csv_str(char *p, const char *s) {
+  if (!s) return p;
+  if (!s[strcspn(s, ",\"\r\n")]) return put_mem(p, s, strlen(s));
+  *p++ = '"';
+  for (; *s; s++) {
+    if (*s == '"') *p++ = '"';
+    *p++ = *s;
+  }
+  *p++ = '"';
+  return p;
+}
+
+static char *put_bin_str(char *p, const char *s) {
+  uint8_t len = s ? strnlen(s, IFNAMSIZ) : 0;
+  *p++ = len;
+  return len ? put_mem(p, s, len) : p;
+}
+
+static char *put_bin_u32(char *p, uint32_t v) {
+  memcpy(p, &v, sizeof(v));
+  return p + sizeof(v);
+}
+
+static const char *master_name(const export_t *ex, const netdev_item_t *dev) {
+  netdev_item_t *m = ex->topo && dev->master_idx ? netdev_topo_master(ex->topo, dev->index) : NULL;
+  return m ? m->name : NULL;
+}
+
+static const char *link_name(const export_t *ex, const netdev_item_t *dev) {
+  netdev_item_t *l = ex->topo && dev->ifla_link_idx ? netdev_topo_lower(ex->topo, dev->index) : NULL;
+  return l ? l->name : NULL;
+}
+
+/* optional field the kernel did not send, not a real zero */
+static inline bool field_missing(unsigned int f, const netdev_item_t *dev) {
+  unsigned int nf = export_netdev_fields(f);
+  return nf && !(dev->fields & nf);
+}
+
+/* one text field (JSON or CSV) */
+static char *put_text_field(const export_t *ex, char *p, unsigned int f, const netdev_item_t *dev) {
+  bool json = ex->fmt == EXPORT_JSON;
+  char *(*put_str)(char *, const char *) = json ? put_json_str : put_csv_str;
+
+  if (field_missing(f, dev)) return json ? put_lit(p, "null") : p;
+  switch (f) {
+  case EXPORT_F_INDEX: return put_i32(p, dev->index);
+  case EXPORT_F_NAME: return put_str(p, dev->name);
+  case EXPORT_F_KIND: return put_str(p, dev->kind);
+  case EXPORT_F_MAC:
+    if (json) *p++ = '"';
+    p = put_mac(p, dev->ll_addr);
+    if (json) *p++ = '"';
+    return p;
+  case EXPORT_F_MASTER: return put_i32(p, dev->master_idx);
+  case EXPORT_F_MASTER_NAME: return put_str(p, master_name(ex, dev));
+  case EXPORT_F_LINK: return put_i32(p, dev->ifla_link_idx);
+  case EXPORT_F_LINK_NAME: return put_str(p, link_name(ex, dev));
+  case EXPORT_F_BRIDGE:
+    if (json) return dev->is_bridge ? put_lit(p, "true") : put_lit(p, "false");
+    *p++ = dev->is_bridge ? '1' : '0';
+    return p;
+  case EXPORT_F_MTU: return put_u32(p, dev->mtu);
+  case EXPORT_F_FLAGS: return put_u32(p, dev->flags);
+  case EXPORT_F_OPERSTATE: return put_u32(p, dev->operstate);
+  case EXPORT_F_TXQLEN: return put_u32(p, dev->txqlen);
+  }
+  return p;
+}
+
+static char *put_bin_field(const export_t *ex, char *p, unsigned int f, const netdev_item_t *dev) {
+  switch (f) {
+  case EXPORT_F_INDEX: return put_bin_u32(p, dev->index);
+  case EXPORT_F_NAME: return put_bin_str(p, dev->name);
+  case EXPORT_F_KIND: return put_bin_str(p, dev->kind);
+  case EXPORT_F_MAC: return put_mem(p, (const char *)dev->ll_addr, ETH_ALEN);
+  case EXPORT_F_MASTER: return put_bin_u32(p, dev->master_idx);
+  case EXPORT_F_MASTER_NAME: return put_bin_str(p, master_name(ex, dev));
+  case EXPORT_F_LINK: return put_bin_u32(p, dev->ifla_link_idx);
+  case EXPORT_F_LINK_NAME: return put_bin_str(p, link_name(ex, dev));
+  case EXPORT_F_BRIDGE: *p++ = dev->is_bridge; return p;
+  case EXPORT_F_MTU: return put_bin_u32(p, dev->mtu);
+  case EXPORT_F_FLAGS: return put_bin_u32(p, dev->flags);
+  case EXPORT_F_OPERSTATE: *p++ = dev->operstate; return p;
+  case EXPORT_F_TXQLEN: return put_bin_u32(p, dev->txqlen);
+  }
+  return p;
+}
+
+int export_flush(export_t *ex) {
+  int ret = write_all(ex->fd, ex->buf, ex->len);
+  if (ret) syslog2(LOG_ERR, "%s write()", strerror(errno));
+  ex->len = 0;
+  return ret;
+}
+
+int export_open(export_t *ex, int fd, export_fmt_t fmt, const export_fields_t *fields, const netdev_topo_t *topo) {
+  FUNC_START_DEBUG;
+  memset(ex, 0, sizeof(*ex));
+  ex->fd = fd;
+  ex->fmt = fmt;
+  /* the binary header only has the mask, readers expect bit order */
+  if (fmt == EXPORT_BIN) {
+    export_fields_mask(&ex->fields, fields->mask);
+  } else {
+    ex->fields = *fields;
+  }
+  ex->topo = topo;
+  ex->buf = malloc(EXPORT_BUFSIZE);
+  if (!ex->buf) {
+    syslog2(LOG_ALERT, "Failed to allocate export buffer.");
+    return -1;
+  }
+
+  char *p = ex->buf;
+  if (fmt == EXPORT_CSV) {
+    for (unsigned int k = 0; k < ex->fields.n; k++) {
+      const char *name = field_names[ex->fields.order[k]];
+      if (k) *p++ = ',';
+      p = put_mem(p, name, strlen(name));
+    }
+    *p++ = '\n';
+  } else if (fmt == EXPORT_BIN) {
+    export_bin_file_t fh = {.magic = EXPORT_BIN_MAGIC, .version = EXPORT_BIN_VERSION, .fields = ex->fields.mask};
+    p = put_mem(p, (const char *)&fh, sizeof(fh));
+  }
+  ex->len = p - ex->buf;
+  return 0;
+}
+
+int export_dev(export_t *ex, const netdev_item_t *dev) {
+  if (ex->len + EXPORT_RECORD_MAX > EXPORT_BUFSIZE && export_flush(ex)) return -1;
+
+  char *start = ex->buf + ex->len;
+  char *p = start;
+  unsigned int mask = ex->fields.mask;
+
+  if (ex->fmt == EXPORT_BIN) p += 2 * sizeof(uint16_t);
+  if (ex->fmt == EXPORT_JSON) *p++ = '{';
+
+  for (unsigned int k = 0; k < ex->fields.n; k++) {
+    unsigned int i = ex->fields.order[k];
+    unsigned int f = 1u << i;
+
+    if (ex->fmt == EXPORT_BIN) {
+      if (field_missing(f, dev)) {
+        mask &= ~f;
+        continue;
+      }
+      p = put_bin_field(ex, p, f, dev);
+      continue;
+    }
+    if (k) *p++ = ',';
+    if (ex->fmt == EXPORT_JSON) {
+      *p++ = '"';
+      p = put_mem(p, field_names[i], strlen(field_names[i]));
+      p = put_lit(p, "\":");
+    }
+    p = put_text_field(ex, p, f, dev);
+  }
+
+  if (ex->fmt == EXPORT_BIN) {
+    uint16_t hdr[2] = {(uint16_t)(p - start), (uint16_t)mask};
+    memcpy(start, hdr, sizeof(hdr));
+  } else {
+    if (ex->fmt == EXPORT_JSON) *p++ = '}';
+    *p++ = '\n';
+  }
+  ex->len = p - ex->buf;
+  return 0;
+}
+
+int export_close(export_t *ex) {
+  FUNC_START_DEBUG;
+  int ret = ex->buf ? export_flush(ex) : 0;
+  free(ex->buf);
+  ex->buf = NULL;
+  return ret;
+}
+
+int export_parse_format(const char *name) {
+  if (!strcmp(name, "json")) return EXPORT_JSON;
+  if (!strcmp(name, "csv")) return EXPORT_CSV;
+  if (!strcmp(name, "bin")) return EXPORT_BIN;
+  return -1;
+}
+
+static void fields_add(export_fields_t *fields, unsigned int i) {
+  if (fields->mask & (1u << i)) return;
+  fields->mask |= 1u << i;
+  fields->order[fields->n++] = i;
+}
+
+void export_fields_mask(export_fields_t *fields, unsigned int mask) {
+  memset(fields, 0, sizeof(*fields));
+  for (unsigned int i = 0; i < EXPORT_F_MAX; i++) {
+    if (mask & (1u << i)) fields_add(fields, i);
+  }
+}
+
+int export_parse_fields(const char *list, export_fields_t *fields) {
+  export_fields_t tmp = {0};
+
+  while (*list) {
+    size_t len = strcspn(list, ",");
+    unsigned int i;
+    if (len == 3 && !strncmp(list, "all", 3)) {
+      for (i = 0; i < EXPORT_F_MAX; i++) fields_add(&tmp, i);
+    } else {
+      for (i = 0; i < EXPORT_F_MAX; i++) {
+        if (strlen(field_names[i]) == len && !strncmp(list, field_names[i], len)) break;
+      }
+      if (i == EXPORT_F_MAX) {
+        errno = EINVAL;
+        return -1;
+      }
+      fields_add(&tmp, i);
+    }
+    list += len;
+    if (*list) list++;
+  }
+  if (!tmp.n) {
+    errno = EINVAL;
+    return -1;
+  }
+  *fields = tmp;
+  return 0;
+}
+
+unsigned int export_netdev_fields(unsigned int fields) {
+  unsigned int nf = 0;
+  if (fields & EXPORT_F_MTU) nf |= NETDEV_F_MTU;
+  if (fields & EXPORT_F_FLAGS) nf |= NETDEV_F_FLAGS;
+  if (fields & EXPORT_F_OPERSTATE) nf |= NETDEV_F_OPERSTATE;
+  if (fields & EXPORT_F_TXQLEN) nf |= NETDEV_F_TXQLEN;
+  return nf;
+}
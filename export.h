@@ -0,0 +1,93 @@
+#ifndef NETLINK_GET_ADDR_EXPORT_H
+#define NETLINK_GET_ADDR_EXPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "libnl_getlink.h"
+#include "topo.h"
+
+/* machine readable device output, formatted by hand into one big buffer
+ * that is written out with write() when it fills up */
+#ifndef EXPORT_BUFSIZE
+#define EXPORT_BUFSIZE (1 << 20)
+#endif
+
+typedef enum export_fmt {
+  EXPORT_JSON, /* one object per line */
+  EXPORT_CSV,  /* header line, then one row per device */
+  EXPORT_BIN,  /* export_bin_file_t, then length prefixed records */
+} export_fmt_t;
+
+/* selectable fields, in output order */
+#define EXPORT_F_INDEX (1u << 0)
+#define EXPORT_F_NAME (1u << 1)
+#define EXPORT_F_KIND (1u << 2)
+#define EXPORT_F_MAC (1u << 3)
+#define EXPORT_F_MASTER (1u << 4)
+#define EXPORT_F_MASTER_NAME (1u << 5) /* needs a topology */
+#define EXPORT_F_LINK (1u << 6)
+#define EXPORT_F_LINK_NAME (1u << 7) /* needs a topology */
+#define EXPORT_F_BRIDGE (1u << 8)
+#define EXPORT_F_MTU (1u << 9)        /* NETDEV_F_MTU */
+#define EXPORT_F_FLAGS (1u << 10)     /* NETDEV_F_FLAGS */
+#define EXPORT_F_OPERSTATE (1u << 11) /* NETDEV_F_OPERSTATE */
+#define EXPORT_F_TXQLEN (1u << 12)    /* NETDEV_F_TXQLEN */
+#define EXPORT_F_MAX 13
+
+#define EXPORT_F_DEFAULT (EXPORT_F_INDEX | EXPORT_F_NAME | EXPORT_F_KIND | EXPORT_F_MAC | EXPORT_F_MASTER | EXPORT_F_LINK)
+
+/* selected fields in output order */
+typedef struct export_fields {
+  unsigned int mask;           /* EXPORT_F_* */
+  unsigned int n;
+  uint8_t order[EXPORT_F_MAX]; /* bit numbers */
+} export_fields_t;
+
+/* binary records are uint16_t length (whole record), uint16_t fields, then
+ * the selected fields in bit order whatever order was asked for, host byte
+ * order: index, master and link
+ * int32_t, names and kind uint8_t length and bytes, mac 6 bytes, bridge and
+ * operstate uint8_t, mtu, flags and txqlen uint32_t. The record fields are
+ * the header ones less optional fields the kernel did not send for that
+ * device, JSON has null and CSV an empty cell for them. */
+#define EXPORT_BIN_MAGIC 0x5645444eu /* "NDEV" */
+#define EXPORT_BIN_VERSION 2
+
+typedef struct export_bin_file {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t fields; /* of the records that follow */
+} export_bin_file_t;
+
+typedef struct export {
+  int fd;
+  export_fmt_t fmt;
+  export_fields_t fields;
+  const netdev_topo_t *topo; /* master and link names, may be NULL */
+  char *buf;
+  size_t len;
+} export_t;
+
+int export_open(export_t *ex, int fd, export_fmt_t fmt, const export_fields_t *fields, const netdev_topo_t *topo);
+int export_dev(export_t *ex, const netdev_item_t *dev);
+int export_flush(export_t *ex);
+/* flush and free the buffer, the fd stays open */
+int export_close(export_t *ex);
+
+/* buffer export_json_str() needs for a string of len bytes */
+#define EXPORT_JSON_STR_SIZE(len) (6 * (len) + 3)
+/* s quoted and escaped as a JSON string into buf, NULL is null, returns buf */
+char *export_json_str(char *buf, const char *s);
+
+/* "json", "csv" or "bin", -1 if unknown */
+int export_parse_format(const char *name);
+/* comma separated field names in the order given, "all" adds the ones not
+ * named yet, -1 at an unknown name */
+int export_parse_fields(const char *list, export_fields_t *fields);
+/* the fields of mask in bit order */
+void export_fields_mask(export_fields_t *fields, unsigned int mask);
+/* NETDEV_F_* the fields need requested from the kernel */
+unsigned int export_netdev_fields(unsigned int fields);
+
+#endif // NETLINK_GET_ADDR_EXPORT_H
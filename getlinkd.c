@@ -0,0 +1,147 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libnl_getlink.h"
+#include "shmcache.h"
+#include "syslog.h"
+
+#include "leak_detector_c.h"
+
+/* link cache daemon: keeps one nl_cache_t current and mirrors it into a
+ * shared memory segment other processes read with nl_shm_open() */
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig) {
+  stop = 1;
+}
+
+#ifdef LEAKCHECK
+/* SIGUSR1 writes the allocation report without stopping */
+static volatile sig_atomic_t report;
+
+static void on_report(int sig) {
+  report = 1;
+}
+#endif
+
+/* publish the table, moving to a bigger segment once it outgrew this one.
+ * Readers of the old one get ESTALE and open the new one. */
+static int publish(nl_shm_t *shm, netdev_table_t *table) {
+  if (!nl_shm_publish(shm, table)) return 0;
+  if (errno != ENOSPC) return -1;
+
+  uint32_t capacity = shm->hdr->capacity;
+  while (capacity < table->count) capacity *= 2;
+
+  nl_shm_t grown;
+  if (nl_shm_create(&grown, shm->name, capacity)) return -1;
+  if (nl_shm_publish(&grown, table)) {
+    nl_shm_unlink(&grown);
+    return -1;
+  }
+  nl_shm_unlink(shm);
+  *shm = grown;
+  syslog2(LOG_NOTICE, "%zu links, %s grown to %u slots", table->count, shm->name, capacity);
+  return 0;
+}
+
+static void usage(const char *prog) {
+  fprintf(stdout, "Usage: %s [-n shm_name] [-c capacity] [-v]\n", prog);
+}
+
+int main(int argc, char **argv) {
+  const char *name = NL_SHM_NAME;
+  uint32_t capacity = NL_SHM_CAPACITY;
+  int level = LOG_NOTICE;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:c:vh")) != -1) {
+    switch (opt) {
+    case 'n':
+      name = optarg;
+      break;
+    case 'c':
+      capacity = strtoul(optarg, NULL, 10);
+      break;
+    case 'v':
+      level = LOG_DEBUG;
+      break;
+    default:
+      usage(argv[0]);
+      return opt == 'h' ? 0 : -1;
+    }
+  }
+  setup_syslog2(level, false);
+
+  struct sigaction sa = {.sa_handler = on_signal};
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+#ifdef LEAKCHECK
+  struct sigaction sa_report = {.sa_handler = on_report};
+  sigaction(SIGUSR1, &sa_report, NULL);
+#endif
+
+  nl_cache_t cache;
+  /* notifications carry the optional fields anyway */
+  if (nl_cache_open(&cache, NETDEV_F_MTU | NETDEV_F_OPERSTATE | NETDEV_F_FLAGS | NETDEV_F_TXQLEN)) return -1;
+
+  nl_shm_t shm;
+  if (nl_shm_create(&shm, name, capacity)) {
+    nl_cache_close(&cache);
+    return -1;
+  }
+  if (publish(&shm, &cache.table)) {
+    nl_shm_unlink(&shm);
+    nl_cache_close(&cache);
+    return -1;
+  }
+  syslog2(LOG_NOTICE, "publishing %zu links in %s", cache.table.count, name);
+
+  struct pollfd pfd = {.fd = nl_cache_fd(&cache), .events = POLLIN};
+  int rc = 0;
+  while (!stop) {
+#ifdef LEAKCHECK
+    if (report) {
+      report = 0;
+      report_mem_leak();
+    }
+#endif
+    int ret = poll(&pfd, 1, 1000);
+    if (ret < 0) {
+      if (errno == EINTR) continue;
+      syslog2(LOG_ERR, "%s poll()", strerror(errno));
+      rc = -1;
+      break;
+    }
+    if (!ret) continue;
+
+    ret = nl_cache_update(&cache);
+    if (ret < 0) {
+      /* let a supervisor start over with a fresh dump */
+      syslog2(LOG_ERR, "%s nl_cache_update()", strerror(errno));
+      rc = -1;
+      break;
+    }
+    if (ret > 0 && publish(&shm, &cache.table)) {
+      rc = -1;
+      break;
+    }
+  }
+
+  const nl_cache_stats_t *st = nl_cache_stats(&cache);
+  syslog2(LOG_NOTICE, "%" PRIu64 " overruns, %" PRIu64 " resyncs (+%" PRIu64 " -%" PRIu64 " ~%" PRIu64 "), max resync %" PRIu64 " us", st->overruns,
+          st->resyncs, st->added, st->removed, st->changed, st->resync.max_ns / 1000);
+  nl_shm_unlink(&shm);
+  nl_cache_close(&cache);
+#ifdef LEAKCHECK
+  report_mem_leak();
+#endif
+  return rc;
+}
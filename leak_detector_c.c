@@ -1,5 +1,10 @@
 #include <malloc.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "leak_detector_c.h"
@@ -9,184 +14,307 @@
 #undef calloc
 #undef free
 
-static MEMLEAK _head;
-static MEMLEAK *head = &_head;
-static char memleak_flag = 0;
+#define LEAK_EMPTY 0
+#define LEAK_TOMB 1
+#define LEAK_OTHER LEAK_SITES /* sites[] slot for the overflow */
+#define LEAK_MIN_CAP 256
 
-static inline void __add_memleak_list(MEMLEAK *new, MEMLEAK *prev, MEMLEAK *next) {
-next->prev = new;
-new->next = next;
-new->prev = prev;
-prev->next = new;
+/* one call site, counters only ever change atomically */
+typedef struct leak_site {
+  _Atomic(const char *) file; /* set last, NULL while the slot is free */
+  unsigned int line;
+  atomic_size_t count;  /* live allocations */
+  atomic_size_t bytes;  /* live bytes */
+  atomic_size_t peak;   /* most live bytes seen */
+  atomic_size_t allocs; /* allocations ever */
+} leak_site_t;
+
+typedef struct leak_entry {
+  uintptr_t addr; /* LEAK_EMPTY, LEAK_TOMB or the allocation */
+  size_t size;
+  uint32_t site;
+} leak_entry_t;
+
+/* open addressing table of the live allocations hashing to this shard */
+typedef struct leak_shard {
+  pthread_mutex_t lock;
+  leak_entry_t *slots;
+  size_t cap;
+  size_t used;
+  size_t tomb;
+} __attribute__((aligned(64))) leak_shard_t;
+
+static leak_shard_t shards[LEAK_SHARDS] = {[0 ... LEAK_SHARDS - 1] = {.lock = PTHREAD_MUTEX_INITIALIZER}};
+static leak_site_t sites[LEAK_SITES + 1];
+static pthread_mutex_t sites_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static atomic_size_t total_bytes;
+static atomic_size_t total_peak;
+static atomic_size_t unknown_frees; /* pointers allocated behind our back */
+static atomic_size_t untracked;     /* allocations the table had no room for */
+
+static inline uint64_t addr_hash(uintptr_t addr) {
+  return (uint64_t)(addr >> 4) * 0x9e3779b97f4a7c15ull;
 }
 
-static inline void memleak_add_list_tail(MEMLEAK *new, MEMLEAK *head) {
-__add_memleak_list(new, head->prev, head);
+static inline leak_shard_t *shard_of(uint64_t h) {
+  return &shards[(h >> 40) % LEAK_SHARDS];
 }
 
-static inline void ht_list_add(MEMLEAK *new, MEMLEAK *head) {
-__add_memleak_list(new, head, head->next);
+static inline void peak_max(atomic_size_t *peak, size_t val) {
+  size_t cur = atomic_load_explicit(peak, memory_order_relaxed);
+  while (val > cur && !atomic_compare_exchange_weak_explicit(peak, &cur, val, memory_order_relaxed, memory_order_relaxed));
 }
 
-static inline void __del_memleak_list(MEMLEAK *prev, MEMLEAK *next) {
-next->prev = prev;
-prev->next = next;
+static inline bool site_match(const leak_site_t *s, const char *f, const char *file, unsigned int line) {
+  /* headers give every translation unit its own copy of __FILE__ */
+  return s->line == line && (f == file || !strcmp(f, file));
 }
 
-static inline void del_memleak_list(MEMLEAK *entry) {
-__del_memleak_list(entry->prev, entry->next);
-free(entry);
+/* FNV-1a of the name, equal strings at different addresses probe the same slots */
+static inline uint32_t site_hash(const char *file, unsigned int line) {
+  uint32_t h = 2166136261u;
+  for (const char *c = file; *c; c++) h = (h ^ (uint8_t)*c) * 16777619u;
+  return (uint32_t)((uint64_t)(h ^ line * 0x9e3779b1u) * 0x9e3779b97f4a7c15ull >> 32);
 }
 
-/*
-* adds allocated memory info. into the list
-*
-*/
-static void add(MEM_INFO alloc_info) {
-MEMLEAK *new = (MEMLEAK *)malloc(sizeof(MEMLEAK));
-new->mem_info.address = alloc_info.address;
-new->mem_info.size = alloc_info.size;
-strcpy(new->mem_info.file_name, alloc_info.file_name);
-new->mem_info.line = alloc_info.line;
+/* index of the site of (file, line), added on first use */
+static uint32_t site_get(const char *file, unsigned int line) {
+  uint32_t h = site_hash(file, line);
 
-if (!memleak_flag) {
-  head->prev = head;
-  head->next = head;
-  memleak_flag = 1;
+  for (uint32_t i = 0; i < LEAK_SITES; i++) {
+    uint32_t idx = (h + i) % LEAK_SITES;
+    const char *f = atomic_load_explicit(&sites[idx].file, memory_order_acquire);
+    if (!f) break;
+    if (site_match(&sites[idx], f, file, line)) return idx;
+  }
+
+  /* not there, probe again under the lock in case another thread adds it */
+  pthread_mutex_lock(&sites_lock);
+  for (uint32_t i = 0; i < LEAK_SITES; i++) {
+    uint32_t idx = (h + i) % LEAK_SITES;
+    const char *f = atomic_load_explicit(&sites[idx].file, memory_order_relaxed);
+    if (!f) {
+      sites[idx].line = line;
+      atomic_store_explicit(&sites[idx].file, file, memory_order_release);
+      pthread_mutex_unlock(&sites_lock);
+      return idx;
+    }
+    if (site_match(&sites[idx], f, file, line)) {
+      pthread_mutex_unlock(&sites_lock);
+      return idx;
+    }
+  }
+  pthread_mutex_unlock(&sites_lock);
+  return LEAK_OTHER;
 }
 
-memleak_add_list_tail(new, head);
+static void site_add(uint32_t idx, size_t size) {
+  leak_site_t *s = &sites[idx];
+  atomic_fetch_add_explicit(&s->count, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&s->allocs, 1, memory_order_relaxed);
+  peak_max(&s->peak, atomic_fetch_add_explicit(&s->bytes, size, memory_order_relaxed) + size);
+  peak_max(&total_peak, atomic_fetch_add_explicit(&total_bytes, size, memory_order_relaxed) + size);
 }
 
-/*
-* deletes all the elements from the list
-*/
-void clear() {
-MEMLEAK *curr = head->next;
+static void site_sub(uint32_t idx, size_t size) {
+  leak_site_t *s = &sites[idx];
+  atomic_fetch_sub_explicit(&s->count, 1, memory_order_relaxed);
+  atomic_fetch_sub_explicit(&s->bytes, size, memory_order_relaxed);
+  atomic_fetch_sub_explicit(&total_bytes, size, memory_order_relaxed);
+}
+
+/* rehash into a table twice the size, or the same size to drop tombstones */
+static int shard_grow(leak_shard_t *sh) {
+  size_t cap = !sh->cap ? LEAK_MIN_CAP : sh->used * 4 >= sh->cap ? sh->cap * 2 : sh->cap;
+  leak_entry_t *slots = calloc(cap, sizeof(*slots));
+  if (!slots) return -1;
+
+  for (size_t i = 0; i < sh->cap; i++) {
+    leak_entry_t *e = &sh->slots[i];
+    if (e->addr <= LEAK_TOMB) continue;
+    size_t pos = addr_hash(e->addr) & (cap - 1);
+    while (slots[pos].addr != LEAK_EMPTY) pos = (pos + 1) & (cap - 1);
+    slots[pos] = *e;
+  }
+  free(sh->slots);
+  sh->slots = slots;
+  sh->cap = cap;
+  sh->tomb = 0;
+  return 0;
+}
+
+static int shard_insert(leak_shard_t *sh, uint64_t h, const leak_entry_t *e) {
+  if ((sh->used + sh->tomb + 1) * 2 > sh->cap && shard_grow(sh) && sh->used + sh->tomb + 1 >= sh->cap) return -1;
+
+  size_t pos = h & (sh->cap - 1);
+  size_t tomb = SIZE_MAX;
+  while (sh->slots[pos].addr != LEAK_EMPTY) {
+    if (sh->slots[pos].addr == LEAK_TOMB && tomb == SIZE_MAX) tomb = pos;
+    pos = (pos + 1) & (sh->cap - 1);
+  }
+  if (tomb != SIZE_MAX) {
+    pos = tomb;
+    sh->tomb--;
+  }
+  sh->slots[pos] = *e;
+  sh->used++;
+  return 0;
+}
+
+/* remove the entry of addr into *out, -1 if it is not tracked */
+static int shard_take(leak_shard_t *sh, uint64_t h, uintptr_t addr, leak_entry_t *out) {
+  if (!sh->cap) return -1;
+
+  size_t pos = h & (sh->cap - 1);
+  while (sh->slots[pos].addr != LEAK_EMPTY) {
+    if (sh->slots[pos].addr == addr) {
+      *out = sh->slots[pos];
+      sh->slots[pos].addr = LEAK_TOMB;
+      sh->used--;
+      sh->tomb++;
+      return 0;
+    }
+    pos = (pos + 1) & (sh->cap - 1);
+  }
+  return -1;
+}
+
+static void track(void *mem_ref, size_t size, uint32_t site) {
+  leak_entry_t e = {.addr = (uintptr_t)mem_ref, .size = size, .site = site};
+  uint64_t h = addr_hash(e.addr);
+  leak_shard_t *sh = shard_of(h);
 
-while (curr != head) {
-  MEMLEAK *temp = curr->next;
-  free(curr);
-  curr = temp;
+  pthread_mutex_lock(&sh->lock);
+  int ret = shard_insert(sh, h, &e);
+  pthread_mutex_unlock(&sh->lock);
+  if (ret) {
+    atomic_fetch_add_explicit(&untracked, 1, memory_order_relaxed);
+    return;
+  }
+  site_add(site, size);
 }
 
-head->next = head;
-head->prev = head;
+static int untrack(void *mem_ref, leak_entry_t *out) {
+  uint64_t h = addr_hash((uintptr_t)mem_ref);
+  leak_shard_t *sh = shard_of(h);
+
+  pthread_mutex_lock(&sh->lock);
+  int ret = shard_take(sh, h, (uintptr_t)mem_ref, out);
+  pthread_mutex_unlock(&sh->lock);
+  if (ret) {
+    atomic_fetch_add_explicit(&unknown_frees, 1, memory_order_relaxed);
+    return -1;
+  }
+  site_sub(out->site, out->size);
+  return 0;
 }
 
 /*
-* replacement of malloc
-*/
+ * replacement of malloc
+ */
 void *xmalloc(unsigned int size, const char *file, unsigned int line) {
-void *ptr = malloc(size);
-if (ptr != NULL) {
-  add_mem_info(ptr, size, file, line);
-}
-return ptr;
+  void *ptr = malloc(size);
+  if (ptr != NULL) {
+    add_mem_info(ptr, size, file, line);
+  }
+  return ptr;
 }
 
 /*
-* replacement of calloc
-*/
+ * replacement of calloc
+ */
 void *xcalloc(unsigned int elements, unsigned int size, const char *file, unsigned int line) {
-unsigned total_size;
-void *ptr = calloc(elements, size);
-if (ptr != NULL) {
-  total_size = elements * size;
-  add_mem_info(ptr, total_size, file, line);
-}
-return ptr;
+  void *ptr = calloc(elements, size);
+  if (ptr != NULL) {
+    track(ptr, (size_t)elements * size, site_get(file, line));
+  }
+  return ptr;
 }
 
 /*
-* replacement of realloc
-*/
+ * replacement of realloc
+ */
 void *xrealloc(void *ptr, unsigned int size, const char *file, unsigned int line) {
-remove_mem_info(ptr);
-ptr = realloc(ptr, size);
-add_mem_info(ptr, size, file, line);
-return ptr;
+  leak_entry_t old;
+
+  if (!ptr) return xmalloc(size, file, line);
+  /* untrack first, once realloc() moves the block the address is free to
+   * be handed out to another thread */
+  bool had = !untrack(ptr, &old);
+  void *new = realloc(ptr, size);
+  if (new) {
+    add_mem_info(new, size, file, line);
+  } else if (had && size) {
+    track(ptr, old.size, old.site); /* failed, the old block is still ours */
+  }
+  return new;
 }
 
 /*
-* replacement of free
-*/
+ * replacement of free
+ */
 void xfree(void *mem_ref) {
-remove_mem_info(mem_ref);
-free(mem_ref);
+  remove_mem_info(mem_ref);
+  free(mem_ref);
 }
 
-/*
-* gets the allocated memory info and adds it to a list
-*
-*/
 void add_mem_info(void *mem_ref, unsigned int size, const char *file, unsigned int line) {
-MEM_INFO info;
+  track(mem_ref, size, site_get(file, line));
+}
 
-/* fill up the structure with all info */
-info.address = mem_ref;
-info.size = size;
-strncpy(info.file_name, file, FILE_NAME_LENGTH);
-info.line = line;
+void remove_mem_info(void *mem_ref) {
+  leak_entry_t e;
+  if (mem_ref) untrack(mem_ref, &e);
+}
 
-/* add the above info to a list */
-add(info);
+static int site_cmp(const void *a, const void *b) {
+  const leak_site_t *x = *(leak_site_t *const *)a, *y = *(leak_site_t *const *)b;
+  size_t xb = atomic_load(&x->bytes), yb = atomic_load(&y->bytes);
+  if (xb != yb) return xb < yb ? 1 : -1;
+  size_t xa = atomic_load(&x->allocs), ya = atomic_load(&y->allocs);
+  return xa < ya ? 1 : xa > ya ? -1 : 0;
 }
 
-/*
-* if the allocated memory info is part of the list, removes it
-*
-*/
-void remove_mem_info(void *mem_ref) {
-MEMLEAK *curr = head;
+void leak_report(FILE *fp) {
+  leak_site_t **list = malloc((LEAK_SITES + 1) * sizeof(*list));
+  size_t n = 0, count = 0;
+  if (!list) return;
 
-/* check if allocate memory is in our list */
-while (curr->next != head) {
-  curr = curr->next;
-  if (curr->mem_info.address == mem_ref) {
-    del_memleak_list(curr);
-    return;
+  for (size_t i = 0; i <= LEAK_SITES; i++) {
+    if (!atomic_load(&sites[i].allocs)) continue;
+    list[n++] = &sites[i];
+    count += atomic_load(&sites[i].count);
   }
-}
+  qsort(list, n, sizeof(*list), site_cmp);
 
-/* if mem_ref not found */
+  fprintf(fp, "Memory Leak Summary\n");
+  fprintf(fp, "-----------------------------------\n");
+  fprintf(fp, "live: %zu allocations, %zu bytes, peak %zu bytes\n", count, atomic_load(&total_bytes), atomic_load(&total_peak));
+  fprintf(fp, "untracked allocations: %zu, unknown frees: %zu\n", atomic_load(&untracked), atomic_load(&unknown_frees));
+  fprintf(fp, "%12s %10s %12s %10s  %s\n", "live bytes", "live", "peak bytes", "allocs", "site");
+  for (size_t i = 0; i < n; i++) {
+    leak_site_t *s = list[i];
+    const char *file = atomic_load(&s->file);
+    fprintf(fp, "%12zu %10zu %12zu %10zu  ", atomic_load(&s->bytes), atomic_load(&s->count), atomic_load(&s->peak), atomic_load(&s->allocs));
+    if (file) {
+      fprintf(fp, "%s:%u\n", file, s->line);
+    } else {
+      fprintf(fp, "other\n");
+    }
+  }
+  free(list);
 }
 
 /*
-* writes all info of the unallocated memory into a file
-*/
+ * writes the report into OUTPUT_FILE
+ */
 void report_mem_leak(void) {
-MEMLEAK *curr = head->next;
-MEMLEAK *next;
-
-FILE *fp_write = fopen(OUTPUT_FILE, "wt");
-char info[1024];
-
-if (fp_write != NULL) {
-  sprintf(info, "%s\n", "Memory Leak Summary");
-  fwrite(info, (strlen(info) + 1), 1, fp_write);
-  sprintf(info, "%s\n", "-----------------------------------");
-  fwrite(info, (strlen(info) + 1), 1, fp_write);
-
-  while (curr->next != head) {
-    printf("HIT\n");
-    next = curr->next;
-    sprintf(info, "address : %zu\n", (size_t)curr->mem_info.address);
-    fwrite(info, (strlen(info) + 1), 1, fp_write);
-    sprintf(info, "size    : %zu bytes\n", (size_t)curr->mem_info.size);
-    fwrite(info, (strlen(info) + 1), 1, fp_write);
-    sprintf(info, "file    : %s\n", curr->mem_info.file_name);
-    fwrite(info, (strlen(info) + 1), 1, fp_write);
-    sprintf(info, "line    : %d\n", curr->mem_info.line);
-    fwrite(info, (strlen(info) + 1), 1, fp_write);
-    sprintf(info, "%s\n", "-----------------------------------");
-    fwrite(info, (strlen(info) + 1), 1, fp_write);
-    curr = next;
+  FILE *fp_write = fopen(OUTPUT_FILE, "wt");
+  if (fp_write == NULL) {
+    perror("Open leak_detector_c infofile error");
+    return;
   }
+  leak_report(fp_write);
   fclose(fp_write);
-
-} else {
-  perror("Open leak_detector_c infofile error");
 }
-clear();
-}
\ No newline at end of file
@@ -2,27 +2,23 @@
 #ifndef LEAK_DETECTOR_C_H
 #define LEAK_DETECTOR_C_H
 
-#define FILE_NAME_LENGTH 512
+#include <stdio.h>
+
 #define OUTPUT_FILE "/tmp/leak_info.txt"
 #define malloc(size) xmalloc(size, __FILE__, __LINE__)
 #define calloc(elements, size) xcalloc(elements, size, __FILE__, __LINE__)
 #define realloc(ptr, size) xrealloc(ptr, size, __FILE__, __LINE__)
 #define free(mem_ref) xfree(mem_ref)
 
-struct _MEM_INFO {
-  void *address;
-  unsigned int size;
-  char file_name[FILE_NAME_LENGTH + 1];
-  unsigned int line;
-};
-typedef struct _MEM_INFO MEM_INFO;
-
-struct _MEMLEAK {
-  MEM_INFO mem_info;
-  struct _MEMLEAK *next;
-  struct _MEMLEAK *prev;
-};
-typedef struct _MEMLEAK MEMLEAK;
+/* live allocations are kept in address hashed shards, each with its own
+ * lock, and counted per call site (file, line) */
+#ifndef LEAK_SHARDS
+#define LEAK_SHARDS 64
+#endif
+/* call sites beyond this are counted together as "other" */
+#ifndef LEAK_SITES
+#define LEAK_SITES 4096
+#endif
 
 void *xmalloc(unsigned int size, const char *file, unsigned int line);
 void *xrealloc(void *ptr, unsigned int size, const char *file, unsigned int line);
@@ -31,7 +27,11 @@ void xfree(void *mem_ref);
 
 void add_mem_info(void *mem_ref, unsigned int size, const char *file, unsigned int line);
 void remove_mem_info(void *mem_ref);
+/* per call site live count, live bytes, peak bytes and total allocations,
+ * largest first. Safe to call at any time, tracking goes on. */
+void leak_report(FILE *fp);
+/* leak_report() into OUTPUT_FILE */
 void report_mem_leak(void);
 
 #endif
-#endif
\ No newline at end of file
+#endif
@@ -2,6 +2,8 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
 #include <linux/types.h>
@@ -12,9 +14,9 @@
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/stat.h> // fchmod
-#include <sys/time.h> /* timeval_t struct */
 #include <sys/types.h>
 #include <syslog.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "libnl_getlink.h"
@@ -87,14 +89,15 @@ void free_netdev_list(struct slist_head *list) {
   netdev_item_t *item = NULL;
   netdev_item_t *tmp = NULL;
 
+  /* the whole list goes away, no need to unlink item by item */
   slist_for_each_entry_safe(item, tmp, list, list) {
-    // Вместо item->next нужно передавать &item->list
-    slist_del_node(&item->list, list);
     free(item);
   }
+  INIT_SLIST_HEAD(list);
 }
 
-netdev_item_t *ll_get_by_index(struct slist_head *list, int index) {
+/* linear, the hashed lookup is netdev_table_get_by_index() */
+netdev_item_t *ll_get_by_index(const struct slist_head *list, int index) {
   // FUNC_START_DEBUG;
   netdev_item_t *item;
   slist_for_each_entry(item, list, list) {
@@ -104,9 +107,518 @@ netdev_item_t *ll_get_by_index(struct slist_head *list, int index) {
   return NULL;
 }
 
-static int send_msg() {
+/* the socket backend keeps the descriptor itself in priv, ctx may be moved */
+#define SOCK_FD(priv) ((int)(intptr_t)(priv))
+
+static int sock_send(void *priv, const void *buf, size_t len) {
+  return send(SOCK_FD(priv), buf, len, 0) < 0 ? -1 : 0;
+}
+
+static ssize_t sock_recv(void *priv, void **buf, size_t size) {
+  struct sockaddr_nl sa;
+  struct iovec iov = {.iov_base = *buf, .iov_len = size};
+  struct msghdr msg = {
+      .msg_name = &sa,
+      .msg_namelen = sizeof(sa),
+      .msg_iov = &iov,
+      .msg_iovlen = 1,
+      .msg_control = NULL,
+      .msg_controllen = 0,
+      .msg_flags = 0};
+
+  return recvmsg(SOCK_FD(priv), &msg, MSG_TRUNC | MSG_DONTWAIT); // MSG_TRUNC returns the real datagram length
+}
+
+static int sock_wait(void *priv, int timeout_ms) {
+  struct pollfd pfd = {.fd = SOCK_FD(priv), .events = POLLIN};
+  return poll(&pfd, 1, timeout_ms);
+}
+
+static int sock_fd(void *priv) {
+  return SOCK_FD(priv);
+}
+
+static void sock_close(void *priv) {
+  close(SOCK_FD(priv)); /* close socket */
+}
+
+static const nl_transport_t sock_transport = {
+    .name = "netlink",
+    .send = sock_send,
+    .recv = sock_recv,
+    .wait = sock_wait,
+    .fd = sock_fd,
+    .close = sock_close,
+};
+
+static inline uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void nl_hist_add(nl_hist_t *hist, uint64_t ns) {
+  int b = ns ? 64 - __builtin_clzll(ns) : 0;
+  if (b >= NL_HIST_BUCKETS) b = NL_HIST_BUCKETS - 1;
+  hist->bucket[b]++;
+  hist->count++;
+  hist->sum_ns += ns;
+  if (ns > hist->max_ns) hist->max_ns = ns;
+}
+
+uint64_t nl_hist_quantile(const nl_hist_t *hist, double q) {
+  uint64_t seen = 0;
+  uint64_t want = q * hist->count;
+  if (!hist->count) return 0;
+  if (want >= hist->count) want = hist->count - 1;
+
+  for (int b = 0; b < NL_HIST_BUCKETS; b++) {
+    seen += hist->bucket[b];
+    if (seen > want) {
+      uint64_t upper = b < NL_HIST_BUCKETS - 1 ? 1ull << b : hist->max_ns;
+      return upper < hist->max_ns ? upper : hist->max_ns;
+    }
+  }
+  return hist->max_ns;
+}
+
+const char *nl_phase_name(int phase) {
+  static const char *names[NL_PHASE_MAX] = {"send", "recv", "parse", "build", "request"};
+  return phase >= 0 && phase < NL_PHASE_MAX ? names[phase] : "unknown";
+}
+
+const nl_stats_t *nl_ctx_stats(const nl_ctx_t *ctx) {
+  return &ctx->stats;
+}
+
+void nl_ctx_stats_reset(nl_ctx_t *ctx) {
+  memset(&ctx->stats, 0, sizeof(ctx->stats));
+}
+
+/* state every backend shares */
+static int ctx_init(nl_ctx_t *ctx, const nl_transport_t *tp, void *priv) {
+  ctx->tp = tp;
+  ctx->tp_priv = priv;
+  ctx->link_types[0] = ARPHRD_ETHER;
+  ctx->nlink_types = 1;
+
+  ctx->bufsize = NL_RECV_BUFSIZE;
+  ctx->buf = malloc(ctx->bufsize);
+  if (!ctx->buf) {
+    syslog2(LOG_ALERT, "Failed to allocate receive buffer.");
+    return -1;
+  }
+  return 0;
+}
+
+int nl_ctx_open_transport(nl_ctx_t *ctx, const nl_transport_t *tp, void *priv) {
+  FUNC_START_DEBUG;
+  memset(ctx, 0, sizeof(*ctx));
+  ctx->sd = -1;
+  return ctx_init(ctx, tp, priv);
+}
+
+int nl_ctx_open(nl_ctx_t *ctx) {
+  FUNC_START_DEBUG;
+  struct sockaddr_nl sa = {.nl_family = AF_NETLINK};
+  socklen_t salen = sizeof(sa);
+
+  memset(ctx, 0, sizeof(*ctx));
+  ctx->sd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE); /* open socket */
+  if (ctx->sd < 0) {
+    syslog2(LOG_ERR, "%s socket()", strerror(errno));
+    return -1;
+  }
+  fchmod(ctx->sd, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+
+  /* reject dump filters the kernel does not understand instead of ignoring them */
+  int one = 1;
+  if (setsockopt(ctx->sd, SOL_NETLINK, NETLINK_GET_STRICT_CHK, &one, sizeof(one)) < 0) {
+    syslog2(LOG_INFO, "%s setsockopt(NETLINK_GET_STRICT_CHK)", strerror(errno));
+  }
+
+  // set socket nonblocking flag, waiting is done by poll() or by the caller's event loop
+  int flags = fcntl(ctx->sd, F_GETFL, 0);
+  fcntl(ctx->sd, F_SETFL, flags | O_NONBLOCK);
+
+  /* bind now to learn our port id, replies addressed to other ports are ignored */
+  if (bind(ctx->sd, (struct sockaddr *)&sa, sizeof(sa)) < 0 ||
+      getsockname(ctx->sd, (struct sockaddr *)&sa, &salen) < 0) {
+    syslog2(LOG_ERR, "%s bind()", strerror(errno));
+    goto err;
+  }
+  ctx->pid = sa.nl_pid;
+
+  if (ctx_init(ctx, &sock_transport, (void *)(intptr_t)ctx->sd)) goto err;
+  return 0;
+
+err:
+  close(ctx->sd);
+  ctx->sd = -1;
+  return -1;
+}
+
+#define NL_RECV_BUFSIZE_MIN 4096
+
+int nl_ctx_set_bufsize(nl_ctx_t *ctx, size_t size) {
+  if (size < NL_RECV_BUFSIZE_MIN) size = NL_RECV_BUFSIZE_MIN;
+  void *tmp = realloc(ctx->buf, size);
+  if (!tmp) {
+    syslog2(LOG_ALERT, "Failed to resize receive buffer to %zu bytes.", size);
+    return -1;
+  }
+  ctx->buf = tmp;
+  ctx->bufsize = size;
+  return 0;
+}
+
+int nl_ctx_set_link_types(nl_ctx_t *ctx, const unsigned short *types, size_t n) {
+  if (n > NL_LINK_TYPES_MAX) {
+    errno = E2BIG;
+    return -1;
+  }
+  for (size_t i = 0; i < n; i++) {
+    ctx->link_types[i] = types[i];
+  }
+  ctx->nlink_types = n;
+  return 0;
+}
+
+void nl_ctx_set_fields(nl_ctx_t *ctx, unsigned int fields) {
+  ctx->fields = fields;
+}
+
+int nl_ctx_fd(nl_ctx_t *ctx) {
+  return ctx->tp->fd ? ctx->tp->fd(ctx->tp_priv) : -1;
+}
+
+void nl_ctx_close(nl_ctx_t *ctx) {
+  FUNC_START_DEBUG;
+  if (ctx->tp) ctx->tp->close(ctx->tp_priv);
+  ctx->tp = NULL;
+  ctx->sd = -1;
+  free(ctx->buf);
+  ctx->buf = NULL;
+  ctx->bufsize = 0;
+}
+
+netdev_item_t *ll_get_by_name(const struct slist_head *list, const char *name) {
+  netdev_item_t *item;
+  slist_for_each_entry(item, list, list) {
+    if (strcmp(item->name, name) == 0) return item;
+  }
+
+  return NULL;
+}
+
+netdev_item_t *ll_get_by_mac(const struct slist_head *list, const uint8_t *mac) {
+  netdev_item_t *item;
+  slist_for_each_entry(item, list, list) {
+    if (memcmp(item->ll_addr, mac, ETH_ALEN) == 0) return item;
+  }
+
+  return NULL;
+}
+
+#define NETDEV_HASH_MIN 64
+
+static inline size_t hash_index(int index) {
+  return (uint32_t)index * 2654435761u; /* Knuth multiplicative */
+}
+
+static inline size_t hash_name(const char *name) {
+  uint32_t h = 2166136261u; /* FNV-1a */
+  while (*name) {
+    h ^= (uint8_t)*name++;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static inline size_t hash_mac(const uint8_t *mac) {
+  uint64_t v = 0;
+  memcpy(&v, mac, ETH_ALEN);
+  v *= 0x9E3779B97F4A7C15ull;
+  return v >> 32;
+}
+
+static void index_link(netdev_table_t *table, netdev_item_t *dev) {
+  size_t i;
+  i = hash_index(dev->index) & table->mask;
+  dev->idx_next = table->by_index[i];
+  table->by_index[i] = dev;
+  i = hash_name(dev->name) & table->mask;
+  dev->name_next = table->by_name[i];
+  table->by_name[i] = dev;
+  i = hash_mac(dev->ll_addr) & table->mask;
+  dev->mac_next = table->by_mac[i];
+  table->by_mac[i] = dev;
+}
+
+/* unlink dev from the chain starting at *pp, next_off is the chain pointer offset */
+static void chain_unlink(netdev_item_t **pp, netdev_item_t *dev, size_t next_off) {
+  while (*pp) {
+    netdev_item_t **next = (netdev_item_t **)((char *)*pp + next_off);
+    if (*pp == dev) {
+      *pp = *next;
+      return;
+    }
+    pp = next;
+  }
+}
+
+static void index_unlink(netdev_table_t *table, netdev_item_t *dev) {
+  chain_unlink(&table->by_index[hash_index(dev->index) & table->mask], dev, offsetof_(netdev_item_t, idx_next));
+  chain_unlink(&table->by_name[hash_name(dev->name) & table->mask], dev, offsetof_(netdev_item_t, name_next));
+  chain_unlink(&table->by_mac[hash_mac(dev->ll_addr) & table->mask], dev, offsetof_(netdev_item_t, mac_next));
+}
+
+/* (re)allocate nbuckets per key and hash all devices again */
+static int index_resize(netdev_table_t *table, size_t nbuckets) {
+  netdev_item_t **buckets = calloc(3 * nbuckets, sizeof(netdev_item_t *));
+  if (!buckets) {
+    syslog2(LOG_ALERT, "Failed to allocate %zu hash buckets.", nbuckets);
+    return -1;
+  }
+  free(table->by_index);
+  table->by_index = buckets;
+  table->by_name = buckets + nbuckets;
+  table->by_mac = buckets + 2 * nbuckets;
+  table->mask = nbuckets - 1;
+
+  netdev_item_t *item;
+  slist_for_each_entry(item, &table->list, list) {
+    index_link(table, item);
+  }
+  return 0;
+}
+
+/* add an arena chunk of nitems records */
+static int arena_grow(netdev_table_t *table, size_t nitems) {
+  netdev_chunk_t *chunk = malloc(sizeof(netdev_chunk_t) + nitems * sizeof(netdev_item_t));
+  if (!chunk) {
+    syslog2(LOG_ALERT, "Failed to allocate arena chunk of %zu items.", nitems);
+    return -1;
+  }
+  chunk->next = table->chunks;
+  chunk->used = 0;
+  chunk->size = nitems;
+  table->chunks = chunk;
+  return 0;
+}
+
+int netdev_table_init(netdev_table_t *table) {
+  memset(table, 0, sizeof(*table));
+  INIT_SLIST_HEAD(&table->list);
+  if (arena_grow(table, NETDEV_HASH_MIN)) return -1;
+  if (index_resize(table, NETDEV_HASH_MIN)) {
+    free(table->chunks);
+    return -1;
+  }
+  return 0;
+}
+
+void netdev_table_free(netdev_table_t *table) {
+  FUNC_START_DEBUG;
+  netdev_item_t *item = NULL;
+  netdev_item_t *tmp = NULL;
+
+  if (table->chunks) {
+    /* one free per chunk, independent of the device count */
+    netdev_chunk_t *chunk = table->chunks;
+    while (chunk) {
+      netdev_chunk_t *next = chunk->next;
+      free(chunk);
+      chunk = next;
+    }
+  } else {
+    slist_for_each_entry_safe(item, tmp, &table->list, list) {
+      free(item);
+    }
+  }
+  free(table->by_index);
+  memset(table, 0, sizeof(*table));
+}
+
+/* zeroed item owned by the table: recycled, bumped from the arena or calloc()ed */
+netdev_item_t *netdev_table_alloc(netdev_table_t *table) {
+  netdev_item_t *dev;
+
+  if (!table->chunks) {
+    dev = calloc(1, sizeof(netdev_item_t));
+  } else if (table->free_items) {
+    dev = table->free_items;
+    table->free_items = dev->prev;
+  } else {
+    netdev_chunk_t *chunk = table->chunks;
+    /* double the chunk size so the chunk count stays logarithmic */
+    if (chunk->used == chunk->size && arena_grow(table, 2 * chunk->size)) return NULL;
+    chunk = table->chunks;
+    dev = &chunk->items[chunk->used++];
+  }
+
+  if (!dev) {
+    syslog2(LOG_ALERT, "Failed to allocate memory for netdev_item_s.");
+    return NULL;
+  }
+  memset(dev, 0, sizeof(*dev));
+  return dev;
+}
+
+/* remove dev from the table and give it back for reuse */
+void netdev_table_release(netdev_table_t *table, netdev_item_t *dev) {
+  netdev_table_del(table, dev);
+  if (!table->chunks) {
+    free(dev);
+    return;
+  }
+  dev->prev = table->free_items;
+  table->free_items = dev;
+}
+
+/* append dev to the list tail and to the index if the table has one */
+void netdev_table_add(netdev_table_t *table, netdev_item_t *dev) {
+  dev->prev = slist_empty(&table->list) ? NULL : slist_entry(table->list.tail, netdev_item_t, list);
+  slist_add_tail(&dev->list, &table->list);
+  table->count++;
+
+  if (!table->by_index) return;
+  /* keep load factor <= 1, on failure the chains just get longer */
+  if (table->count > table->mask + 1 && index_resize(table, 2 * (table->mask + 1)) == 0) return;
+  index_link(table, dev);
+}
+
+/* unlink dev using its back pointer, no predecessor search */
+void netdev_table_del(netdev_table_t *table, netdev_item_t *dev) {
+  netdev_item_t *next = dev->list.next ? slist_entry(dev->list.next, netdev_item_t, list) : NULL;
+
+  if (table->by_index) index_unlink(table, dev);
+  if (dev->prev) {
+    slist_del_next(&dev->prev->list, &table->list);
+  } else {
+    slist_del_head(&table->list);
+  }
+  if (next) next->prev = dev->prev;
+  dev->list.next = NULL;
+  dev->prev = NULL;
+  table->count--;
+}
+
+/* replace the contents of dev keeping its list position */
+void netdev_table_update(netdev_table_t *table, netdev_item_t *dev, const netdev_item_t *src) {
+  netdev_item_t tmp = *src;
+  if (table->by_index) index_unlink(table, dev);
+  tmp.list = dev->list;
+  tmp.prev = dev->prev;
+  *dev = tmp;
+  if (table->by_index) index_link(table, dev);
+}
+
+/* only a table filled by hand without netdev_table_init() has no index */
+netdev_item_t *netdev_table_get_by_index(const netdev_table_t *table, int index) {
+  if (!table->by_index) return ll_get_by_index(&table->list, index);
+
+  netdev_item_t *item = table->by_index[hash_index(index) & table->mask];
+  for (; item; item = item->idx_next) {
+    if (item->index == index) return item;
+  }
+  return NULL;
+}
+
+netdev_item_t *netdev_table_get_by_name(const netdev_table_t *table, const char *name) {
+  if (!table->by_index) return ll_get_by_name(&table->list, name);
+
+  netdev_item_t *item = table->by_name[hash_name(name) & table->mask];
+  for (; item; item = item->name_next) {
+    if (strcmp(item->name, name) == 0) return item;
+  }
+  return NULL;
+}
+
+netdev_item_t *netdev_table_get_by_mac(const netdev_table_t *table, const uint8_t *mac) {
+  if (!table->by_index) return ll_get_by_mac(&table->list, mac);
+
+  netdev_item_t *item = table->by_mac[hash_mac(mac) & table->mask];
+  for (; item; item = item->mac_next) {
+    if (memcmp(item->ll_addr, mac, ETH_ALEN) == 0) return item;
+  }
+  return NULL;
+}
+
+unsigned int netdev_item_changes(const netdev_item_t *a, const netdev_item_t *b) {
+  unsigned int changed = 0;
+  unsigned int both = a->fields & b->fields;
+
+  if (strcmp(a->name, b->name)) changed |= NETDEV_CHG_NAME;
+  if (memcmp(a->ll_addr, b->ll_addr, ETH_ALEN)) changed |= NETDEV_CHG_MAC;
+  if (a->master_idx != b->master_idx) changed |= NETDEV_CHG_MASTER;
+  if (a->ifla_link_idx != b->ifla_link_idx) changed |= NETDEV_CHG_LINK;
+  if (strcmp(a->kind, b->kind)) changed |= NETDEV_CHG_KIND;
+  /* optional fields count only if both sides have them */
+  if ((both & NETDEV_F_MTU) && a->mtu != b->mtu) changed |= NETDEV_CHG_MTU;
+  if ((both & NETDEV_F_FLAGS) && a->flags != b->flags) changed |= NETDEV_CHG_FLAGS;
+  if ((both & NETDEV_F_OPERSTATE) && a->operstate != b->operstate) changed |= NETDEV_CHG_OPERSTATE;
+  if ((both & NETDEV_F_TXQLEN) && a->txqlen != b->txqlen) changed |= NETDEV_CHG_TXQLEN;
+  return changed;
+}
+
+int netdev_table_diff(netdev_table_t *old, netdev_table_t *new, netdev_diff_cb cb, void *arg) {
+  FUNC_START_DEBUG;
+  netdev_item_t *item, *other;
+  int ret;
+
+  /* one pass over each side with O(1) lookups in the other one */
+  slist_for_each_entry(item, &new->list, list) {
+    other = netdev_table_get_by_index(old, item->index);
+    if (!other) {
+      ret = cb(NETDEV_DIFF_ADDED, NULL, item, 0, arg);
+    } else {
+      unsigned int changed = netdev_item_changes(other, item);
+      ret = changed ? cb(NETDEV_DIFF_CHANGED, other, item, changed, arg) : 0;
+    }
+    if (ret) return ret;
+  }
+
+  slist_for_each_entry(item, &old->list, list) {
+    if (netdev_table_get_by_index(new, item->index)) continue;
+    ret = cb(NETDEV_DIFF_REMOVED, item, NULL, 0, arg);
+    if (ret) return ret;
+  }
+  return 0;
+}
+
+/* read out the rest of an unfinished dump, the kernel refuses a new one while it runs */
+static void drain_msg(nl_ctx_t *ctx) {
+  void *buf = ctx->buf;
+  while (ctx->tp->recv(ctx->tp_priv, &buf, ctx->bufsize) > 0)
+    buf = ctx->buf;
+  ctx->pending = false;
+}
+
+static int addattr_str(struct nlmsghdr *n, unsigned int maxlen, int type, const char *str) {
+  return addattr_l(n, maxlen, type, str, strlen(str) + 1);
+}
+
+static struct rtattr *addattr_nest(struct nlmsghdr *n, unsigned int maxlen, int type) {
+  struct rtattr *nest = NLMSG_TAIL(n);
+  if (addattr_l(n, maxlen, type, NULL, 0)) return NULL;
+  return nest;
+}
+
+static void addattr_nest_end(struct nlmsghdr *n, struct rtattr *nest) {
+  nest->rta_len = (void *)NLMSG_TAIL(n) - (void *)nest;
+}
+
+/* single device requests are plain RTM_GETLINK, everything else is a dump */
+static inline bool filter_single(const netdev_filter_t *f) {
+  return f->index > 0 || f->name[0];
+}
+
+/* send RTM_GETLINK for ctx->filter */
+static int send_msg(nl_ctx_t *ctx) {
   // FUNC_START_DEBUG;
   ssize_t status;
+  const netdev_filter_t *f = &ctx->filter;
   struct {
     struct nlmsghdr nlh;
     struct ifinfomsg m;
@@ -116,194 +628,828 @@ static int send_msg() {
       .nlh.nlmsg_type = RTM_GETLINK,
       .nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP | NLM_F_ACK,
       .nlh.nlmsg_pid = 0,
-      .nlh.nlmsg_seq = 1,
   };
-  int err = addattr32(&req.nlh, sizeof(req), IFLA_EXT_MASK, RTEXT_FILTER_VF);
-  if (err) {
-    syslog2(LOG_ERR, "%s addattr32(&req.nlh, sizeof(req), IFLA_EXT_MASK, RTEXT_FILTER_VF)", strerror(errno));
-    return -1;
-  }
+  /* per-VF info and statistics are big, let the kernel attach them only on request */
+  uint32_t ext_mask = 0;
+  if (ctx->fields & NETDEV_F_VF) ext_mask |= RTEXT_FILTER_VF;
+  if (!(ctx->fields & NETDEV_F_STATS64)) ext_mask |= RTEXT_FILTER_SKIP_STATS;
+  int err = addattr32(&req.nlh, sizeof(req), IFLA_EXT_MASK, ext_mask);
 
-  int sd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE); /* open socket */
-  if (sd < 0) {
-    syslog2(LOG_ERR, "%s socket()", strerror(errno));
+  if (filter_single(f)) {
+    /* the reply is one RTM_NEWLINK or an NLMSG_ERROR */
+    req.nlh.nlmsg_flags = NLM_F_REQUEST;
+    req.m.ifi_index = f->index;
+    if (!err && f->name[0]) err = addattr_str(&req.nlh, sizeof(req), IFLA_IFNAME, f->name);
+  } else {
+    /* filtered in the kernel: link_master_filtered(), link_kind_filtered() */
+    if (!err && f->master_idx) err = addattr32(&req.nlh, sizeof(req), IFLA_MASTER, f->master_idx);
+    if (!err && f->kind[0]) {
+      struct rtattr *linkinfo = addattr_nest(&req.nlh, sizeof(req), IFLA_LINKINFO);
+      err = !linkinfo || addattr_str(&req.nlh, sizeof(req), IFLA_INFO_KIND, f->kind);
+      if (!err) addattr_nest_end(&req.nlh, linkinfo);
+    }
+  }
+  if (err) {
+    syslog2(LOG_ERR, "failed to build RTM_GETLINK request");
+    errno = EMSGSIZE;
     return -1;
   }
-  fchmod(sd, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
 
-  // set socket nonblocking flag
-  int flags = fcntl(sd, F_GETFL, 0);
-  fcntl(sd, F_SETFL, flags | O_NONBLOCK);
-
-  // set socket timeout 100ms
-  struct timeval tv = {.tv_sec = 0, .tv_usec = 100000};
-  if (setsockopt(sd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
-    perror("setsockopt");
-    return -2;
-  }
+  if (ctx->pending) drain_msg(ctx);
+  req.nlh.nlmsg_seq = ++ctx->seq;
 
   /* send message */
-  status = send(sd, &req, req.nlh.nlmsg_len, 0);
+  uint64_t t0 = now_ns();
+  status = ctx->tp->send(ctx->tp_priv, &req, req.nlh.nlmsg_len);
+  nl_hist_add(&ctx->stats.phase[NL_PHASE_SEND], now_ns() - t0);
+  ctx->stats.requests++;
   if (status < 0) {
-    status = errno;
     syslog2(LOG_NOTICE, "%s send()", strerror(errno));
-    close(sd); /* close socket */
     return -1;
   }
-  return sd;
+  ctx->pending = true;
+  return 0;
 }
 
-static ssize_t recv_msg(int sd, void **buf) {
-  // FUNC_START_DEBUG;
-  ssize_t bufsize = 512;
-  *buf = malloc(bufsize);
-  struct iovec iov = {.iov_base = *buf, .iov_len = bufsize};
-  struct sockaddr_nl sa;
+/* a datagram of len bytes did not fit: grow the buffer for the next one,
+ * -1 with errno EMSGSIZE */
+static ssize_t recv_truncated(nl_ctx_t *ctx, ssize_t len) {
+  ctx->stats.truncated++;
+  syslog2(LOG_NOTICE, "datagram of %zd bytes truncated, receive buffer is %zu", len, ctx->bufsize);
+  if (nl_ctx_set_bufsize(ctx, (len + NL_RECV_BUFSIZE_MIN) & ~(NL_RECV_BUFSIZE_MIN - 1))) return -1;
+  errno = EMSGSIZE;
+  return -1;
+}
+
+/* receive one datagram from sd into the ctx buffer with a single recvmsg().
+ * A datagram larger than the buffer is lost: the buffer is grown for the
+ * next attempt and -1 is returned with errno EMSGSIZE. stamp, if set, gets
+ * the SO_TIMESTAMPNS time or now. */
+static ssize_t recv_chunk(int sd, nl_ctx_t *ctx, struct sockaddr_nl *sa, struct timespec *stamp) {
+  struct iovec iov = {.iov_base = ctx->buf, .iov_len = ctx->bufsize};
+  union {
+    char buf[CMSG_SPACE(sizeof(struct timespec))];
+    struct cmsghdr align;
+  } control;
   struct msghdr msg = {
-      .msg_name = &sa,
-      .msg_namelen = sizeof(sa),
+      .msg_name = sa,
+      .msg_namelen = sizeof(*sa),
       .msg_iov = &iov,
       .msg_iovlen = 1,
-      .msg_control = NULL,
-      .msg_controllen = 0,
+      .msg_control = stamp ? control.buf : NULL,
+      .msg_controllen = stamp ? sizeof(control.buf) : 0,
       .msg_flags = 0};
 
-  fd_set readset;
-  FD_ZERO(&readset);
-  FD_SET(sd, &readset);
-  struct timeval timeout = {.tv_sec = 1, .tv_usec = 0}; // 1 sec. timeout
-  int ret = select(sd + 1, &readset, NULL, NULL, &timeout);
-  if (ret == 0) {
-    return ret;
-  } else if (ret < 0) {
-    if (errno == EINTR) {
-      syslog2(LOG_WARNING, "select EINTR");
-      return ret;
+  ssize_t len = recvmsg(sd, &msg, MSG_TRUNC | MSG_DONTWAIT); // MSG_TRUNC returns the real datagram length
+  if (len <= 0) return len;
+
+  if (stamp) {
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+      memcpy(stamp, CMSG_DATA(cmsg), sizeof(*stamp));
+    } else {
+      clock_gettime(CLOCK_REALTIME, stamp);
     }
-    syslog2(LOG_ERR, "select error=%s", strerror(errno));
-    return ret;
   }
 
-  ssize_t len = recvmsg(sd, &msg, MSG_PEEK | MSG_TRUNC | MSG_DONTWAIT); // MSG_DONTWAIT to enable non-blocking mode
+  if ((size_t)len > ctx->bufsize) return recv_truncated(ctx, len);
+  return len;
+}
+
+/* same for the request in progress through the ctx transport, *buf is set
+ * to where the datagram is */
+static ssize_t ctx_recv(nl_ctx_t *ctx, void **buf) {
+  *buf = ctx->buf;
+  uint64_t t0 = now_ns();
+  ssize_t len = ctx->tp->recv(ctx->tp_priv, buf, ctx->bufsize);
   if (len <= 0) return len;
+  nl_hist_add(&ctx->stats.phase[NL_PHASE_RECV], now_ns() - t0);
+  ctx->stats.datagrams++;
+  ctx->stats.bytes += len;
 
-  if (len > bufsize) {
-    bufsize = len;
-    *buf = realloc(*buf, bufsize);
-    iov.iov_base = *buf;
-    iov.iov_len = bufsize;
-  }
-  len = recvmsg(sd, &msg, MSG_DONTWAIT);
+  if (*buf == ctx->buf && (size_t)len > ctx->bufsize) return recv_truncated(ctx, len);
   return len;
 }
 
-static int parse_recv_chunk(void *buf, ssize_t len, struct slist_head *list) {
+/* copy string attribute, truncating it to size - 1 bytes */
+static void rta_strlcpy(char *dst, size_t size, struct rtattr *rta) {
+  size_t len = strnlen(RTA_DATA(rta), RTA_PAYLOAD(rta));
+  if (len >= size) len = size - 1;
+  memcpy(dst, RTA_DATA(rta), len);
+  dst[len] = '\0';
+}
+
+/* link type filter, by default loopback and other non ARPHRD_ETHER are skipped */
+static inline bool link_type_ok(const nl_ctx_t *ctx, struct nlmsghdr *nh) {
+  struct ifinfomsg *msg = NLMSG_DATA(nh);
+  if (!ctx->nlink_types) return true;
+  for (size_t i = 0; i < ctx->nlink_types; i++) {
+    if (msg->ifi_type == ctx->link_types[i]) return true;
+  }
+  return false;
+}
+
+/* the kernel may not know the kind filter (module not loaded) and then
+ * dumps everything, so check the result here as well */
+static inline bool link_filter_ok(const netdev_filter_t *f, const netdev_item_t *dev) {
+  if (f->master_idx && dev->master_idx != f->master_idx) return false;
+  if (f->kind[0] && strcmp(dev->kind, f->kind)) return false;
+  return true;
+}
+
+/* fill dev from RTM_NEWLINK message, returns 1 if the link must be skipped */
+static int parse_link_msg(struct nlmsghdr *nh, netdev_item_t *dev, unsigned int fields) {
+  struct rtattr *tb[IFLA_MAX + 1] = {0};
+  (void)parse_nlbuf(nh, tb);
+  // ssize_t nlmsg_len = parse_nlbuf(nh, tb);
+  // syslog2(LOG_INFO, "parsed nlmsg_len: %zd", nlmsg_len);
+
+  struct ifinfomsg *msg = NLMSG_DATA(nh); /* macro to get a ptr right after header */
+
+  memset(dev, 0, sizeof(*dev));
+  dev->index = msg->ifi_index;
+
+  if (tb[IFLA_LINKINFO]) {
+    struct rtattr *linkinfo[IFLA_INFO_MAX + 1];
+    parse_rtattr_nested(linkinfo, IFLA_INFO_MAX, tb[IFLA_LINKINFO]);
+
+    if (linkinfo[IFLA_INFO_KIND]) {
+      rta_strlcpy(dev->kind, sizeof(dev->kind), linkinfo[IFLA_INFO_KIND]);
+      if (strcmp("bridge", dev->kind) == 0) dev->is_bridge = true;
+    }
+  }
+
+  if (!tb[IFLA_IFNAME]) {
+    syslog2(LOG_WARNING, "IFLA_IFNAME attribute is missing.");
+    return 1;
+  }
+  rta_strlcpy(dev->name, sizeof(dev->name), tb[IFLA_IFNAME]);
+
+  if (tb[IFLA_LINK]) {
+    dev->ifla_link_idx = *(uint32_t *)RTA_DATA(tb[IFLA_LINK]);
+  }
+
+  if (tb[IFLA_MASTER]) {
+    dev->master_idx = *(uint32_t *)RTA_DATA(tb[IFLA_MASTER]);
+  }
+
+  /* mac */
+  if (tb[IFLA_ADDRESS]) {
+    size_t alen = RTA_PAYLOAD(tb[IFLA_ADDRESS]);
+    memcpy((void *)&dev->ll_addr, RTA_DATA(tb[IFLA_ADDRESS]), alen < ETH_ALEN ? alen : ETH_ALEN);
+  }
+
+  /* optional fields, only what the caller asked for and the kernel sent */
+  if (!fields) return 0;
+
+  if (fields & NETDEV_F_FLAGS) {
+    dev->flags = msg->ifi_flags;
+    dev->fields |= NETDEV_F_FLAGS;
+  }
+
+  if ((fields & NETDEV_F_MTU) && tb[IFLA_MTU]) {
+    dev->mtu = *(uint32_t *)RTA_DATA(tb[IFLA_MTU]);
+    dev->fields |= NETDEV_F_MTU;
+  }
+
+  if ((fields & NETDEV_F_OPERSTATE) && tb[IFLA_OPERSTATE]) {
+    dev->operstate = *(uint8_t *)RTA_DATA(tb[IFLA_OPERSTATE]);
+    dev->fields |= NETDEV_F_OPERSTATE;
+  }
+
+  if ((fields & NETDEV_F_TXQLEN) && tb[IFLA_TXQLEN]) {
+    dev->txqlen = *(uint32_t *)RTA_DATA(tb[IFLA_TXQLEN]);
+    dev->fields |= NETDEV_F_TXQLEN;
+  }
+
+  if ((fields & NETDEV_F_STATS64) && tb[IFLA_STATS64]) {
+    size_t slen = RTA_PAYLOAD(tb[IFLA_STATS64]);
+    memcpy(&dev->stats64, RTA_DATA(tb[IFLA_STATS64]), slen < sizeof(dev->stats64) ? slen : sizeof(dev->stats64));
+    dev->fields |= NETDEV_F_STATS64;
+  }
+
+  if ((fields & NETDEV_F_VF) && tb[IFLA_NUM_VF]) {
+    dev->num_vf = *(uint32_t *)RTA_DATA(tb[IFLA_NUM_VF]);
+    dev->fields |= NETDEV_F_VF;
+  }
+  return 0;
+}
+
+/* devices parsed before they are handed to the visitor together, so parse
+ * and build time are taken once per batch instead of once per device */
+#ifndef NL_PARSE_BATCH
+#define NL_PARSE_BATCH 32
+#endif
+
+typedef struct parse_batch {
+  int n;
+  uint64_t mark;     /* end of the previous phase */
+  uint64_t parse_ns; /* of this datagram */
+  uint64_t build_ns;
+  netdev_item_t dev[NL_PARSE_BATCH];
+  const struct nlmsghdr *nh[NL_PARSE_BATCH];
+} parse_batch_t;
+
+/* visit the batched devices, returns like the visitor */
+static int batch_flush(nl_ctx_t *ctx, parse_batch_t *b) {
+  uint64_t t = now_ns();
+  int ret = 0;
+
+  b->parse_ns += t - b->mark;
+  for (int i = 0; i < b->n && !ret; i++) {
+    ret = ctx->visit(&b->dev[i], b->nh[i], ctx->visit_arg);
+    ctx->stats.devices++;
+  }
+  b->n = 0;
+  b->mark = now_ns();
+  b->build_ns += b->mark - t;
+  return ret;
+}
+
+/* returns 0 if more chunks follow, 1 when the reply is complete or the visitor
+ * stopped it, 2 if the dump must be restarted, -1 on error with errno set */
+static int parse_recv_chunk(nl_ctx_t *ctx, void *buf, ssize_t len) {
   // FUNC_START_DEBUG;
-  size_t counter = 0;
   struct nlmsghdr *nh;
+  parse_batch_t b;
+  int status = 0;
 
-  /*check length */
-  if (len <= 0) {
-    return -1;
-  }
+  b.n = 0;
+  b.mark = now_ns();
+  b.parse_ns = b.build_ns = 0;
 
   for (nh = (struct nlmsghdr *)buf; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
-    if (counter > 100) {
-      syslog2(LOG_ALERT, "counter %zu > 100", counter);
-      break;
+    /* leftovers of an earlier request on this socket */
+    if (nh->nlmsg_seq != ctx->seq || nh->nlmsg_pid != ctx->pid) {
+      continue;
     }
+    ctx->stats.messages++;
+
+    // syslog2(LOG_DEBUG, "msg type len: %d NLMSG len: %zu FLAGS NLM_F_MULTI: %s", nh->nlmsg_type, (size_t)nh->nlmsg_len, nh->nlmsg_flags & NLM_F_MULTI ? "true" : "false");
 
-    // syslog2(LOG_DEBUG, "cnt: %zu msg type len: %d NLMSG len: %zu FLAGS NLM_F_MULTI: %s", counter++, nh->nlmsg_type, (size_t)nh->nlmsg_len, nh->nlmsg_flags & NLM_F_MULTI ? "true" : "false");
+    /* the link set changed while the kernel was walking it, the result may
+     * miss or duplicate devices. The batch is dropped with it. */
+    if (nh->nlmsg_flags & NLM_F_DUMP_INTR) {
+      syslog2(LOG_INFO, "NLM_F_DUMP_INTR, restarting dump");
+      b.n = 0;
+      status = 2;
+      break;
+    }
 
     /* The end of multipart message */
     if (nh->nlmsg_type == NLMSG_DONE) {
       // syslog2(LOG_DEBUG, "NLMSG_DONE");
-      return -1;
+      status = 1;
+      break;
     }
 
-    /* Error handling */
+    /* Error handling, error 0 is an ack */
     if (nh->nlmsg_type == NLMSG_ERROR) {
-      // syslog2(LOG_DEBUG, "NLMSG_ERROR");
-      continue;
+      struct nlmsgerr *err = NLMSG_DATA(nh);
+      if (nh->nlmsg_len < NLMSG_LENGTH(sizeof(*err)) || !err->error) continue;
+      syslog2(LOG_DEBUG, "NLMSG_ERROR %s", strerror(-err->error));
+      ctx->stats.errors++;
+      ctx->pending = false;
+      errno = -err->error;
+      return -1;
     }
 
-    struct rtattr *tb[IFLA_MAX + 1] = {0};
-    (void)parse_nlbuf(nh, tb);
-    // ssize_t nlmsg_len = parse_nlbuf(nh, tb);
-    // syslog2(LOG_INFO, "parsed nlmsg_len: %zd", nlmsg_len);
-
-    netdev_item_t *dev = NULL;
-    struct ifinfomsg *msg = NLMSG_DATA(nh); /* macro to get a ptr right after header */
-    /* skip loopback device and other non ARPHRD_ETHER */
-
-    if (msg->ifi_type != ARPHRD_ETHER) {
-      continue;
+    /* single device answers are not multipart, nothing follows them */
+    bool last = !(nh->nlmsg_flags & NLM_F_MULTI);
+    bool single = filter_single(&ctx->filter);
+    netdev_item_t *dev = &b.dev[b.n];
+    if (nh->nlmsg_type != RTM_NEWLINK || (!single && !link_type_ok(ctx, nh)) || parse_link_msg(nh, dev, ctx->fields) ||
+        (!single && !link_filter_ok(&ctx->filter, dev))) {
+      ctx->stats.skipped++;
+    } else {
+      b.nh[b.n++] = nh;
+    }
+    if (last) {
+      status = 1;
+      break;
     }
 
-    if (!dev) {
-      dev = calloc(1, sizeof(netdev_item_t));
-      if (!dev) {
-        syslog2(LOG_ALERT, "Failed to allocate memory for netdev_item_s.");
-        return -1;
+    if (b.n == NL_PARSE_BATCH) {
+      int ret = batch_flush(ctx, &b);
+      if (ret) {
+        status = ret < 0 ? -1 : 3;
+        break;
       }
     }
+    // syslog2(LOG_DEBUG, "FLAGS NLM_F_MULTI: %s", nh->nlmsg_flags & NLM_F_MULTI ? "true" : "false");
+  }
+
+  if (b.n) {
+    int ret = batch_flush(ctx, &b);
+    if (ret) status = ret < 0 ? -1 : 3;
+  } else {
+    b.parse_ns += now_ns() - b.mark;
+  }
+  nl_hist_add(&ctx->stats.phase[NL_PHASE_PARSE], b.parse_ns);
+  if (b.build_ns) nl_hist_add(&ctx->stats.phase[NL_PHASE_BUILD], b.build_ns);
+
+  switch (status) {
+  case 1:
+    ctx->pending = false;
+    return 1;
+  case 3:
+    return 1; /* stopped early, the rest is drained by the next request */
+  default:
+    return status;
+  }
+}
+
+/* drop the devices appended after last (NULL: all of them) */
+static void table_trim(netdev_table_t *table, netdev_item_t *last) {
+  while (!slist_empty(&table->list)) {
+    netdev_item_t *tail = slist_entry(table->list.tail, netdev_item_t, list);
+    if (tail == last) break;
+    netdev_table_release(table, tail);
+  }
+}
+
+/* visitor of table dumps: copy each device into the table */
+static int table_visit(const netdev_item_t *dev, const struct nlmsghdr *nh, void *arg) {
+  nl_ctx_t *ctx = arg;
+  netdev_table_t *table = ctx->dump_table;
+
+  if (!dev) {
+    /* restarted, forget what this dump added so far */
+    table_trim(table, ctx->dump_last);
+    return 0;
+  }
+
+  netdev_item_t *item = netdev_table_alloc(table);
+  if (!item) {
+    errno = ENOMEM;
+    return -1;
+  }
+  *item = *dev;
+  netdev_table_add(table, item); // append dev to list tail
+  return 0;
+}
+
+/* send the request for filter, the reply goes to visit */
+static int request_start(nl_ctx_t *ctx, const netdev_filter_t *filter, netdev_visit_cb visit, void *arg) {
+  if (ctx->visit) {
+    errno = EBUSY;
+    return -1;
+  }
+  if (filter) {
+    ctx->filter = *filter;
+  } else {
+    memset(&ctx->filter, 0, sizeof(ctx->filter));
+  }
+  /* send req on the already open socket */
+  ctx->req_start_ns = now_ns();
+  if (send_msg(ctx)) {
+    ctx->stats.failed++;
+    return -1;
+  }
+
+  ctx->visit = visit;
+  ctx->visit_arg = arg;
+  ctx->restarts = 0;
+  return 0;
+}
+
+/* tell the visitor to forget what it got and ask again */
+static int request_restart(nl_ctx_t *ctx) {
+  ctx->stats.restarts++;
+  if (++ctx->restarts > NL_DUMP_MAX_RESTARTS) {
+    syslog2(LOG_ERR, "dump interrupted %u times, giving up", ctx->restarts - 1);
+    errno = EAGAIN;
+    return -1;
+  }
+  if (ctx->visit(NULL, NULL, ctx->visit_arg) < 0) return -1;
+  return send_msg(ctx);
+}
+
+/* request whose reply is appended to table */
+static int request_start_table(nl_ctx_t *ctx, const netdev_filter_t *filter, netdev_table_t *table, nl_dump_cb cb, void *arg) {
+  if (request_start(ctx, filter, table_visit, ctx)) return -1;
+
+  ctx->dump_table = table;
+  ctx->dump_last = slist_empty(&table->list) ? NULL : slist_entry(table->list.tail, netdev_item_t, list);
+  ctx->dump_cb = cb;
+  ctx->dump_arg = arg;
+  return 0;
+}
+
+int nl_dump_start(nl_ctx_t *ctx, netdev_table_t *table, nl_dump_cb cb, void *arg) {
+  FUNC_START_DEBUG;
+  return request_start_table(ctx, NULL, table, cb, arg);
+}
+
+int nl_dump_start_filtered(nl_ctx_t *ctx, const netdev_filter_t *filter, netdev_table_t *table, nl_dump_cb cb, void *arg) {
+  FUNC_START_DEBUG;
+  return request_start_table(ctx, filter, table, cb, arg);
+}
+
+int nl_dump_start_each(nl_ctx_t *ctx, const netdev_filter_t *filter, netdev_visit_cb cb, void *arg) {
+  FUNC_START_DEBUG;
+  return request_start(ctx, filter, cb, arg);
+}
+
+/* end the request in progress and report it to the caller */
+static int dump_finish(nl_ctx_t *ctx, int status) {
+  netdev_table_t *table = ctx->dump_table;
+  nl_dump_cb cb = ctx->dump_cb;
+  int err = errno;
+
+  if (status < 0) {
+    ctx->stats.failed++;
+  } else {
+    ctx->stats.completed++;
+  }
+  nl_hist_add(&ctx->stats.phase[NL_PHASE_REQUEST], now_ns() - ctx->req_start_ns);
+  nl_dump_cancel(ctx);
+  if (cb) cb(ctx, table, status, ctx->dump_arg);
+  errno = err;
+  return status < 0 ? -1 : 1;
+}
+
+void nl_dump_cancel(nl_ctx_t *ctx) {
+  /* the rest of the reply is drained by the next request */
+  ctx->visit = NULL;
+  ctx->dump_table = NULL;
+  ctx->dump_cb = NULL;
+}
 
-    dev->index = msg->ifi_index;
+int nl_dump_process(nl_ctx_t *ctx) {
+  // FUNC_START_DEBUG;
+  void *buf;
 
-    if (tb[IFLA_LINKINFO]) {
-      struct rtattr *linkinfo[IFLA_INFO_MAX + 1];
-      parse_rtattr_nested(linkinfo, IFLA_INFO_MAX, tb[IFLA_LINKINFO]);
+  if (!ctx->visit) {
+    errno = EINVAL;
+    return -1;
+  }
 
-      if (linkinfo[IFLA_INFO_KIND]) {
-        memcpy(dev->kind, RTA_DATA(linkinfo[IFLA_INFO_KIND]), IFNAMSIZ);
-        if (strcmp("bridge", dev->kind) == 0) dev->is_bridge = true;
+  /* read whatever is queued, never block */
+  for (;;) {
+    ssize_t len = ctx_recv(ctx, &buf);
+    if (len < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+      if (errno == EINTR) continue;
+      if (errno == EMSGSIZE) {
+        /* a datagram was lost, the buffer is bigger now, start over */
+        if (request_restart(ctx)) return dump_finish(ctx, -1);
+        continue;
       }
+      syslog2(LOG_ERR, "%s recv(%s)", strerror(errno), ctx->tp->name);
+      return dump_finish(ctx, -1);
     }
 
-    if (!tb[IFLA_IFNAME]) {
-      syslog2(LOG_WARNING, "IFLA_IFNAME attribute is missing.");
-      continue;
-    } else {
-      strcpy(dev->name, (char *)RTA_DATA(tb[IFLA_IFNAME]));
-    }
+    int status = nl_dump_feed(ctx, buf, len);
+    if (status) return status;
+  }
+}
 
-    if (tb[IFLA_LINK]) {
-      dev->ifla_link_idx = *(uint32_t *)RTA_DATA(tb[IFLA_LINK]);
-    }
+int nl_dump_feed(nl_ctx_t *ctx, void *buf, size_t len) {
+  if (!ctx->visit) {
+    errno = EINVAL;
+    return -1;
+  }
 
-    if (tb[IFLA_MASTER]) {
-      dev->master_idx = *(uint32_t *)RTA_DATA(tb[IFLA_MASTER]);
-    }
+  int status = parse_recv_chunk(ctx, buf, len);
+  if (status == 2) {
+    if (request_restart(ctx)) return dump_finish(ctx, -1);
+    return 0;
+  }
+  if (status) return dump_finish(ctx, status > 0 ? 0 : -1);
+  return 0;
+}
 
-    /* mac */
-    if (tb[IFLA_ADDRESS]) {
-      memcpy((void *)&dev->ll_addr, RTA_DATA(tb[IFLA_ADDRESS]), ETH_ALEN);
+/* block until the request in progress completes */
+static int request_wait(nl_ctx_t *ctx) {
+  /* recv and parse kernel answers */
+  int status;
+  while ((status = nl_dump_process(ctx)) == 0) {
+    int ret = ctx->tp->wait(ctx->tp_priv, NL_RECV_TIMEOUT_MS);
+    if (ret < 0 && errno == EINTR) continue;
+    if (ret <= 0) {
+      if (ret == 0) {
+        ctx->stats.timeouts++;
+        errno = ETIMEDOUT;
+      }
+      syslog2(LOG_ERR, "%s wait(%s)", strerror(errno), ctx->tp->name);
+      ctx->stats.failed++;
+      nl_dump_cancel(ctx);
+      return -1;
     }
+  }
 
-    if (dev) slist_add_tail(&dev->list, list); // append dev to list tail
+  return status < 0 ? -1 : 0;
+}
 
-    // syslog2(LOG_DEBUG, "FLAGS NLM_F_MULTI: %s", nh->nlmsg_flags & NLM_F_MULTI ? "true" : "false");
+int get_netdev_table(nl_ctx_t *ctx, netdev_table_t *table) {
+  FUNC_START_DEBUG;
+  if (request_start_table(ctx, NULL, table, NULL, NULL)) return -1;
+  return request_wait(ctx);
+}
+
+int get_netdev_filtered(nl_ctx_t *ctx, const netdev_filter_t *filter, netdev_table_t *table) {
+  FUNC_START_DEBUG;
+  if (request_start_table(ctx, filter, table, NULL, NULL)) return -1;
+  return request_wait(ctx);
+}
+
+int get_netdev_each(nl_ctx_t *ctx, const netdev_filter_t *filter, netdev_visit_cb cb, void *arg) {
+  FUNC_START_DEBUG;
+  if (request_start(ctx, filter, cb, arg)) return -1;
+  return request_wait(ctx);
+}
+
+/* single device query into dev, ENODEV if there is no such device */
+static int get_netdev_one(nl_ctx_t *ctx, const netdev_filter_t *filter, netdev_item_t *dev) {
+  netdev_table_t table = {0}; /* no arena, no index: one calloc()ed item */
+  int ret = get_netdev_filtered(ctx, filter, &table);
+
+  if (!ret && slist_empty(&table.list)) {
+    errno = ENODEV;
+    ret = -1;
+  }
+  if (!ret) {
+    *dev = *slist_entry(table.list.head, netdev_item_t, list);
+    dev->list.next = NULL;
+    dev->prev = dev->idx_next = dev->name_next = dev->mac_next = NULL;
+  }
+  netdev_table_free(&table);
+  return ret;
+}
+
+int get_netdev_by_index(nl_ctx_t *ctx, int index, netdev_item_t *dev) {
+  netdev_filter_t filter = {.index = index};
+  if (index <= 0) {
+    errno = EINVAL;
+    return -1;
   }
+  return get_netdev_one(ctx, &filter, dev);
+}
 
-  return 0;
+int get_netdev_by_name(nl_ctx_t *ctx, const char *name, netdev_item_t *dev) {
+  netdev_filter_t filter = {0};
+  if (!name[0] || strlen(name) >= IFNAMSIZ) {
+    errno = EINVAL;
+    return -1;
+  }
+  strcpy(filter.name, name);
+  return get_netdev_one(ctx, &filter, dev);
+}
+
+int get_netdev_ctx(nl_ctx_t *ctx, struct slist_head *list) {
+  FUNC_START_DEBUG;
+  /* the table only borrows the list head, new items are calloc()ed and appended to it; no arena, no index */
+  netdev_table_t table = {.list = *list};
+  int ret = get_netdev_table(ctx, &table);
+  *list = table.list;
+  return ret;
 }
 
 int get_netdev(struct slist_head *list) {
   FUNC_START_DEBUG;
-  int sd;
-  void *buf;
-  ssize_t len;
-  /*open socket and send req */
-  sd = send_msg();
+  nl_ctx_t ctx;
+  /*open socket */
+  if (nl_ctx_open(&ctx)) return -1;
 
-  /* recv and parse kernel answers */
-  int status = 0;
-  while (status == 0) {
-    len = recv_msg(sd, &buf);
-    status = parse_recv_chunk(buf, len, list);
-    free(buf);
+  int ret = get_netdev_ctx(&ctx, list);
+
+  nl_ctx_close(&ctx); /* close socket */
+  return ret;
+}
+
+int nl_cache_open(nl_cache_t *cache, unsigned int fields) {
+  FUNC_START_DEBUG;
+  struct sockaddr_nl sa = {.nl_family = AF_NETLINK, .nl_groups = RTMGRP_LINK};
+
+  cache->sd = -1;
+  cache->cb = NULL;
+  cache->cb_arg = NULL;
+  memset(&cache->stats, 0, sizeof(cache->stats));
+  if (netdev_table_init(&cache->table)) return -1;
+  /* subscribe before the initial dump so no change falls in between */
+  cache->sd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+  if (cache->sd < 0) {
+    syslog2(LOG_ERR, "%s socket()", strerror(errno));
+    netdev_table_free(&cache->table);
+    return -1;
+  }
+  if (bind(cache->sd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+    syslog2(LOG_ERR, "%s bind(RTMGRP_LINK)", strerror(errno));
+    close(cache->sd);
+    netdev_table_free(&cache->table);
+    return -1;
+  }
+  /* the kernel stamps each notification, callbacks can tell how old it is */
+  int one = 1;
+  if (setsockopt(cache->sd, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one)) < 0) {
+    syslog2(LOG_INFO, "%s setsockopt(SO_TIMESTAMPNS)", strerror(errno));
+  }
+  nl_cache_set_rcvbuf(cache, NL_CACHE_RCVBUF);
+
+  if (nl_ctx_open(&cache->ctx)) {
+    close(cache->sd);
+    netdev_table_free(&cache->table);
+    return -1;
+  }
+  nl_ctx_set_fields(&cache->ctx, fields);
+  if (get_netdev_table(&cache->ctx, &cache->table)) {
+    nl_cache_close(cache);
+    return -1;
   }
+  return 0;
+}
+
+void nl_cache_close(nl_cache_t *cache) {
+  FUNC_START_DEBUG;
+  netdev_table_free(&cache->table);
+  nl_ctx_close(&cache->ctx);
+  if (cache->sd >= 0) close(cache->sd);
+  cache->sd = -1;
+}
+
+int nl_cache_fd(nl_cache_t *cache) {
+  return cache->sd;
+}
+
+int nl_cache_set_rcvbuf(nl_cache_t *cache, int bytes) {
+  socklen_t len = sizeof(cache->rcvbuf);
+  int ret = 0;
+
+  /* FORCE ignores net.core.rmem_max but needs CAP_NET_ADMIN */
+  if (setsockopt(cache->sd, SOL_SOCKET, SO_RCVBUFFORCE, &bytes, sizeof(bytes)) < 0 &&
+      setsockopt(cache->sd, SOL_SOCKET, SO_RCVBUF, &bytes, sizeof(bytes)) < 0) {
+    syslog2(LOG_WARNING, "%s setsockopt(SO_RCVBUF, %d)", strerror(errno), bytes);
+    ret = -1;
+  }
+  if (getsockopt(cache->sd, SOL_SOCKET, SO_RCVBUF, &cache->rcvbuf, &len) < 0) cache->rcvbuf = 0;
+  /* the kernel doubles the value for bookkeeping */
+  if (cache->rcvbuf < bytes) syslog2(LOG_INFO, "notification buffer %d bytes, wanted %d", cache->rcvbuf, bytes);
+  return ret;
+}
+
+const nl_cache_stats_t *nl_cache_stats(const nl_cache_t *cache) {
+  return &cache->stats;
+}
+
+void nl_cache_set_cb(nl_cache_t *cache, netdev_diff_cb cb, void *arg) {
+  cache->cb = cb;
+  cache->cb_arg = arg;
+}
+
+int nl_cache_set_fields(nl_cache_t *cache, unsigned int fields) {
+  FUNC_START_DEBUG;
+  netdev_table_t table;
 
-  close(sd); /* close socket */
+  nl_ctx_set_fields(&cache->ctx, fields);
+  if (netdev_table_init(&table)) return -1;
+  if (get_netdev_table(&cache->ctx, &table)) {
+    netdev_table_free(&table);
+    return -1;
+  }
+  netdev_table_free(&cache->table);
+  cache->table = table;
   return 0;
 }
+
+/* apply one RTM_NEWLINK/RTM_DELLINK notification, returns 1 if the table changed */
+static int cache_apply(nl_cache_t *cache, struct nlmsghdr *nh) {
+  netdev_table_t *table = &cache->table;
+  struct ifinfomsg *msg = NLMSG_DATA(nh);
+  netdev_item_t *old;
+  netdev_item_t tmp;
+
+  /* bridge port events (AF_BRIDGE) do not add or remove the link itself */
+  if (msg->ifi_family == AF_BRIDGE) return 0;
+
+  old = netdev_table_get_by_index(table, msg->ifi_index);
+
+  if (nh->nlmsg_type == RTM_DELLINK || !link_type_ok(&cache->ctx, nh) || parse_link_msg(nh, &tmp, cache->ctx.fields)) {
+    if (!old) return 0;
+    if (cache->cb) cache->cb(NETDEV_DIFF_REMOVED, old, NULL, 0, cache->cb_arg);
+    netdev_table_release(table, old);
+    return 1;
+  }
+
+  if (old) {
+    unsigned int changed = cache->cb ? netdev_item_changes(old, &tmp) : 0;
+    netdev_item_t prev;
+    if (changed) prev = *old;
+    netdev_table_update(table, old, &tmp);
+    if (changed) cache->cb(NETDEV_DIFF_CHANGED, &prev, old, changed, cache->cb_arg);
+    return 1;
+  }
+
+  netdev_item_t *dev = netdev_table_alloc(table);
+  if (!dev) return -1;
+  *dev = tmp;
+  netdev_table_add(table, dev);
+  if (cache->cb) cache->cb(NETDEV_DIFF_ADDED, NULL, dev, 0, cache->cb_arg);
+  return 1;
+}
+
+/* notifications were lost: dump again and apply only what differs, so the
+ * callback sees the missed changes and untouched items stay where they are.
+ * Returns the number of differences. */
+static int cache_resync(nl_cache_t *cache) {
+  uint64_t start = now_ns();
+  netdev_table_t fresh;
+  netdev_item_t *item, *tmp, *old;
+  int changes = 0;
+
+  /* whatever is still queued is older than the dump about to start */
+  for (;;) {
+    struct sockaddr_nl sa;
+    ssize_t len = recv_chunk(cache->sd, &cache->ctx, &sa, NULL);
+    if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+    if (len < 0 && errno != EMSGSIZE && errno != EINTR && errno != ENOBUFS) break;
+    if (len >= 0 || errno == EMSGSIZE) cache->stats.discarded++;
+  }
+
+  clock_gettime(CLOCK_REALTIME, &cache->stamp);
+  if (netdev_table_init(&fresh)) return -1;
+  if (get_netdev_table(&cache->ctx, &fresh)) {
+    netdev_table_free(&fresh);
+    return -1;
+  }
+
+  slist_for_each_entry(item, &fresh.list, list) {
+    old = netdev_table_get_by_index(&cache->table, item->index);
+    if (!old) {
+      netdev_item_t *dev = netdev_table_alloc(&cache->table);
+      if (!dev) {
+        netdev_table_free(&fresh);
+        return -1;
+      }
+      *dev = *item;
+      netdev_table_add(&cache->table, dev);
+      cache->stats.added++;
+      if (cache->cb) cache->cb(NETDEV_DIFF_ADDED, NULL, dev, 0, cache->cb_arg);
+      changes++;
+      continue;
+    }
+    unsigned int changed = netdev_item_changes(old, item);
+    if (!changed) continue;
+    netdev_item_t prev = *old;
+    netdev_table_update(&cache->table, old, item);
+    cache->stats.changed++;
+    if (cache->cb) cache->cb(NETDEV_DIFF_CHANGED, &prev, old, changed, cache->cb_arg);
+    changes++;
+  }
+
+  slist_for_each_entry_safe(item, tmp, &cache->table.list, list) {
+    if (netdev_table_get_by_index(&fresh, item->index)) continue;
+    cache->stats.removed++;
+    if (cache->cb) cache->cb(NETDEV_DIFF_REMOVED, item, NULL, 0, cache->cb_arg);
+    netdev_table_release(&cache->table, item);
+    changes++;
+  }
+  netdev_table_free(&fresh);
+
+  uint64_t ns = now_ns() - start;
+  cache->stats.resyncs++;
+  nl_hist_add(&cache->stats.resync, ns);
+  syslog2(LOG_NOTICE, "resync after overrun: %d differences in %" PRIu64 " us", changes, ns / 1000);
+  return changes;
+}
+
+int nl_cache_update(nl_cache_t *cache) {
+  // FUNC_START_DEBUG;
+  int changes = 0;
+
+  for (;;) {
+    struct sockaddr_nl sa;
+    ssize_t len = recv_chunk(cache->sd, &cache->ctx, &sa, &cache->stamp);
+    if (len < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+      if (errno == EINTR) continue;
+      /* either way notifications are gone and the table may be stale */
+      if (errno == ENOBUFS || errno == EMSGSIZE) {
+        if (errno == ENOBUFS) {
+          cache->stats.overruns++;
+          syslog2(LOG_WARNING, "link notifications overrun, dumping again");
+        } else {
+          cache->stats.truncated++;
+          syslog2(LOG_WARNING, "link notification truncated, dumping again");
+        }
+        int ret = cache_resync(cache);
+        if (ret < 0) return -1;
+        changes += ret;
+        continue;
+      }
+      syslog2(LOG_ERR, "%s recvmsg()", strerror(errno));
+      return -1;
+    }
+    if (len == 0 || sa.nl_pid != 0) continue; /* accept kernel messages only */
+
+    struct nlmsghdr *nh;
+    for (nh = cache->ctx.buf; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+      if (nh->nlmsg_type != RTM_NEWLINK && nh->nlmsg_type != RTM_DELLINK) continue;
+      int ret = cache_apply(cache, nh);
+      if (ret < 0) return -1;
+      changes += ret;
+    }
+  }
+
+  return changes;
+}
@@ -1,10 +1,12 @@
 #ifndef NETLINK_GET_ADDR_LIBNL_GETLINK_H
 #define NETLINK_GET_ADDR_LIBNL_GETLINK_H
 
+#include <linux/if_link.h>
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <time.h>
 
 #include <stdarg.h>      // va_list, va_start(), va_end()
 #include <stdio.h>       // printf()
@@ -25,8 +27,20 @@
 #define NLMSG_TAIL(nmsg) \
   ((struct rtattr *)(((void *)(nmsg)) + NLMSG_ALIGN((nmsg)->nlmsg_len)))
 
+/* optional netdev_item_t fields, index, names, master, link, kind and MAC are always there */
+#define NETDEV_F_MTU (1u << 0)       /* IFLA_MTU */
+#define NETDEV_F_OPERSTATE (1u << 1) /* IFLA_OPERSTATE */
+#define NETDEV_F_FLAGS (1u << 2)     /* ifi_flags, IFF_UP etc. */
+#define NETDEV_F_TXQLEN (1u << 3)    /* IFLA_TXQLEN */
+#define NETDEV_F_STATS64 (1u << 4)   /* IFLA_STATS64, otherwise RTEXT_FILTER_SKIP_STATS */
+#define NETDEV_F_VF (1u << 5)        /* RTEXT_FILTER_VF, IFLA_NUM_VF */
+
 typedef struct netdev_item {
   struct slist_node list;
+  struct netdev_item *prev;    /* back link maintained by netdev_table_t */
+  struct netdev_item *idx_next;  /* netdev_table_t hash chains */
+  struct netdev_item *name_next;
+  struct netdev_item *mac_next;
   int index;
   int master_idx;              /* master device */
   int ifla_link_idx;       /* ifla_link index */
@@ -34,6 +48,14 @@ typedef struct netdev_item {
   bool is_bridge;
   char name[IFNAMSIZ + 1];
   uint8_t ll_addr[ETH_ALEN];
+
+  unsigned int fields;         /* NETDEV_F_* requested and sent by the kernel */
+  unsigned int flags;
+  uint32_t mtu;
+  uint32_t txqlen;
+  uint32_t num_vf;
+  uint8_t operstate;
+  struct rtnl_link_stats64 stats64;
 } netdev_item_t;
 
 typedef struct nl_req {
@@ -41,8 +63,264 @@ typedef struct nl_req {
   struct rtgenmsg gen;
 } nl_req_s;
 
+/* default receive buffer, the kernel does not build dump datagrams bigger
+ * than 32K unless a single message needs more */
+#ifndef NL_RECV_BUFSIZE
+#define NL_RECV_BUFSIZE 32768
+#endif
+
+/* how long the blocking calls wait for the next datagram */
+#ifndef NL_RECV_TIMEOUT_MS
+#define NL_RECV_TIMEOUT_MS 1000
+#endif
+
+/* how often a dump is restarted after NLM_F_DUMP_INTR before failing with EAGAIN */
+#ifndef NL_DUMP_MAX_RESTARTS
+#define NL_DUMP_MAX_RESTARTS 16
+#endif
+
+/* socket receive buffer of nl_cache_t notifications. Past it the kernel
+ * drops them and the cache has to dump again. */
+#ifndef NL_CACHE_RCVBUF
+#define NL_CACHE_RCVBUF (4 << 20)
+#endif
+
+/* size of the link type (ARPHRD_*) filter set */
+#define NL_LINK_TYPES_MAX 16
+
+struct nl_ctx;
+struct netdev_table;
+
+/* what to ask the kernel for, zeroed: every link */
+typedef struct netdev_filter {
+  int index;               /* one device by ifindex */
+  char name[IFNAMSIZ + 1]; /* one device by name */
+  int master_idx;          /* dump ports of this master only */
+  char kind[IFNAMSIZ + 1]; /* dump links of this IFLA_INFO_KIND only */
+} netdev_filter_t;
+
+/* streaming visitor, dev lives on the stack and nh in the receive buffer,
+ * both only until the callback returns. dev == NULL means the dump was
+ * restarted and devices will be reported again. Return 0 to continue,
+ * > 0 to stop, < 0 to fail the request. */
+typedef int (*netdev_visit_cb)(const struct netdev_item *dev, const struct nlmsghdr *nh, void *arg);
+
+/* async dump completion, status is 0 or -1 with errno set */
+typedef void (*nl_dump_cb)(struct nl_ctx *ctx, struct netdev_table *table, int status, void *arg);
+
+/* what requests are sent over and replies read from, the NETLINK_ROUTE
+ * socket by default. priv is the backend state given to nl_ctx_open_transport(). */
+typedef struct nl_transport {
+  const char *name;
+  int (*send)(void *priv, const void *buf, size_t len);
+  /* one datagram, never blocking: *buf points to a buffer of size bytes, a
+   * backend holding the data in memory may point it there instead. Returns
+   * the datagram length (bigger than size if it was cut), -1 with errno
+   * EAGAIN if nothing is queued. */
+  ssize_t (*recv)(void *priv, void **buf, size_t size);
+  /* > 0 once recv() has data, 0 after timeout_ms */
+  int (*wait)(void *priv, int timeout_ms);
+  int (*fd)(void *priv); /* pollable descriptor or -1 */
+  void (*close)(void *priv);
+} nl_transport_t;
+
+/* latency histogram: bucket i counts samples of [2^(i-1), 2^i) ns, the
+ * last bucket everything longer */
+#define NL_HIST_BUCKETS 32
+
+typedef struct nl_hist {
+  uint64_t count;
+  uint64_t sum_ns;
+  uint64_t max_ns;
+  uint64_t bucket[NL_HIST_BUCKETS];
+} nl_hist_t;
+
+/* timed phases: send a request, receive a datagram, parse it into devices,
+ * hand them to the table or visitor, and the whole request */
+enum {
+  NL_PHASE_SEND,
+  NL_PHASE_RECV,
+  NL_PHASE_PARSE,
+  NL_PHASE_BUILD,
+  NL_PHASE_REQUEST,
+  NL_PHASE_MAX
+};
+
+/* per handle counters, plain increments in the request path */
+typedef struct nl_stats {
+  uint64_t requests;  /* sent, restarts included */
+  uint64_t completed;
+  uint64_t failed;
+  uint64_t restarts;  /* NLM_F_DUMP_INTR and lost datagrams */
+  uint64_t timeouts;  /* waits for the next datagram that expired */
+  uint64_t datagrams;
+  uint64_t bytes;
+  uint64_t truncated; /* datagrams lost to a short receive buffer */
+  uint64_t messages;  /* netlink messages of our requests */
+  uint64_t errors;    /* NLMSG_ERROR other than acks */
+  uint64_t devices;   /* handed to the table or visitor */
+  uint64_t skipped;   /* filtered out or unparsable */
+  nl_hist_t phase[NL_PHASE_MAX];
+} nl_stats_t;
+
+/* long-lived netlink handle: open once, dump many times, close once */
+typedef struct nl_ctx {
+  int sd;         /* NETLINK_ROUTE socket, -1 with another transport */
+  const nl_transport_t *tp;
+  void *tp_priv;
+  uint32_t pid;   /* port id assigned by the kernel */
+  uint32_t seq;   /* sequence number of the last request */
+  bool pending;   /* last dump was not read up to NLMSG_DONE */
+  netdev_filter_t filter; /* request in progress */
+  unsigned int fields;    /* NETDEV_F_* to request and parse */
+  unsigned short link_types[NL_LINK_TYPES_MAX]; /* ARPHRD_* to keep, ARPHRD_ETHER by default */
+  size_t nlink_types;                           /* 0: keep every link type */
+  unsigned int restarts;  /* restarts of the request in progress */
+  void *buf;      /* receive buffer reused across dumps */
+  size_t bufsize; /* allocated size of buf */
+
+  netdev_visit_cb visit;           /* request in progress, NULL if none */
+  void *visit_arg;
+  struct netdev_table *dump_table; /* destination of table dumps */
+  struct netdev_item *dump_last;   /* table tail before the dump, kept on restart */
+  nl_dump_cb dump_cb;
+  void *dump_arg;
+
+  uint64_t req_start_ns; /* request in progress */
+  nl_stats_t stats;
+} nl_ctx_t;
+
+/* arena chunk holding device records */
+typedef struct netdev_chunk {
+  struct netdev_chunk *next;
+  size_t used;
+  size_t size;
+  netdev_item_t items[];
+} netdev_chunk_t;
+
+/* device set owning its items, hashed by ifindex, name and MAC */
+typedef struct netdev_table {
+  struct slist_head list; /* devices in dump order */
+  size_t count;
+  netdev_chunk_t *chunks;     /* arena the items live in, NULL: items are calloc()ed */
+  netdev_item_t *free_items;  /* released arena items, linked through prev */
+  netdev_item_t **by_index; /* bucket arrays, NULL if the table is not indexed */
+  netdev_item_t **by_name;
+  netdev_item_t **by_mac;
+  size_t mask;              /* buckets per key - 1 */
+} netdev_table_t;
+
+/* netdev_table_diff() results, changed is a mask of NETDEV_CHG_* */
+#define NETDEV_CHG_NAME (1u << 0)
+#define NETDEV_CHG_MAC (1u << 1)
+#define NETDEV_CHG_MASTER (1u << 2)
+#define NETDEV_CHG_LINK (1u << 3)
+#define NETDEV_CHG_KIND (1u << 4)
+#define NETDEV_CHG_MTU (1u << 5)
+#define NETDEV_CHG_FLAGS (1u << 6)
+#define NETDEV_CHG_OPERSTATE (1u << 7)
+#define NETDEV_CHG_TXQLEN (1u << 8)
+
+typedef enum netdev_diff {
+  NETDEV_DIFF_ADDED,   /* only new is set */
+  NETDEV_DIFF_REMOVED, /* only old is set */
+  NETDEV_DIFF_CHANGED, /* same ifindex, some field differs */
+} netdev_diff_t;
+
+/* nonzero return stops the walk and is returned by netdev_table_diff() */
+typedef int (*netdev_diff_cb)(netdev_diff_t what, const netdev_item_t *old, const netdev_item_t *new, unsigned int changed, void *arg);
+
+/* notification losses and what recovering from them cost */
+typedef struct nl_cache_stats {
+  uint64_t overruns;  /* ENOBUFS, the kernel dropped notifications */
+  uint64_t truncated; /* notifications bigger than the receive buffer */
+  uint64_t resyncs;   /* dumps reconciled into the table */
+  uint64_t discarded; /* stale datagrams thrown away before a resync */
+  uint64_t added;     /* resync differences */
+  uint64_t removed;
+  uint64_t changed;
+  nl_hist_t resync;   /* drain, dump and reconcile */
+} nl_cache_stats_t;
+
+/* device table kept current by RTMGRP_LINK notifications */
+typedef struct nl_cache {
+  nl_ctx_t ctx;          /* dump handle */
+  int sd;                /* notification socket */
+  netdev_table_t table;  /* current devices, read only for the caller */
+  netdev_diff_cb cb;     /* told about every change applied, return value ignored */
+  void *cb_arg;
+  struct timespec stamp; /* CLOCK_REALTIME the kernel queued the notification being applied */
+  int rcvbuf;            /* socket receive buffer the kernel granted */
+  nl_cache_stats_t stats;
+} nl_cache_t;
+
+int nl_ctx_open(nl_ctx_t *ctx);
+/* handle on another backend, see nlrecord.h for record and replay */
+int nl_ctx_open_transport(nl_ctx_t *ctx, const nl_transport_t *tp, void *priv);
+void nl_ctx_close(nl_ctx_t *ctx);
+int nl_ctx_set_bufsize(nl_ctx_t *ctx, size_t size);
+int nl_ctx_fd(nl_ctx_t *ctx);
+void nl_ctx_set_fields(nl_ctx_t *ctx, unsigned int fields);
+int nl_ctx_set_link_types(nl_ctx_t *ctx, const unsigned short *types, size_t n);
+/* counters and phase latencies since open or the last reset */
+const nl_stats_t *nl_ctx_stats(const nl_ctx_t *ctx);
+void nl_ctx_stats_reset(nl_ctx_t *ctx);
+const char *nl_phase_name(int phase);
+void nl_hist_add(nl_hist_t *hist, uint64_t ns);
+/* upper bound of the q quantile (0..1) in ns, 0 without samples */
+uint64_t nl_hist_quantile(const nl_hist_t *hist, double q);
+
+/* non-blocking dump: start it, wait for nl_ctx_fd() to become readable and
+ * call nl_dump_process() until it returns 1 (done) or -1 (failed) */
+int nl_dump_start(nl_ctx_t *ctx, struct netdev_table *table, nl_dump_cb cb, void *arg);
+int nl_dump_start_filtered(nl_ctx_t *ctx, const netdev_filter_t *filter, struct netdev_table *table, nl_dump_cb cb, void *arg);
+/* same with a streaming visitor instead of a table */
+int nl_dump_start_each(nl_ctx_t *ctx, const netdev_filter_t *filter, netdev_visit_cb cb, void *arg);
+int nl_dump_process(nl_ctx_t *ctx);
+/* process one datagram received elsewhere for the request in progress,
+ * returns like nl_dump_process(), -1 with EINVAL if none is in progress */
+int nl_dump_feed(nl_ctx_t *ctx, void *buf, size_t len);
+void nl_dump_cancel(nl_ctx_t *ctx);
+int get_netdev_ctx(nl_ctx_t *ctx, struct slist_head *list);
+int get_netdev_table(nl_ctx_t *ctx, netdev_table_t *table);
+int get_netdev_filtered(nl_ctx_t *ctx, const netdev_filter_t *filter, netdev_table_t *table);
+int get_netdev_each(nl_ctx_t *ctx, const netdev_filter_t *filter, netdev_visit_cb cb, void *arg);
+int get_netdev_by_index(nl_ctx_t *ctx, int index, netdev_item_t *dev);
+int get_netdev_by_name(nl_ctx_t *ctx, const char *name, netdev_item_t *dev);
+
+int netdev_table_init(netdev_table_t *table);
+void netdev_table_free(netdev_table_t *table);
+netdev_item_t *netdev_table_alloc(netdev_table_t *table);
+void netdev_table_release(netdev_table_t *table, netdev_item_t *dev);
+void netdev_table_add(netdev_table_t *table, netdev_item_t *dev);
+void netdev_table_del(netdev_table_t *table, netdev_item_t *dev);
+void netdev_table_update(netdev_table_t *table, netdev_item_t *dev, const netdev_item_t *src);
+netdev_item_t *netdev_table_get_by_index(const netdev_table_t *table, int index);
+netdev_item_t *netdev_table_get_by_name(const netdev_table_t *table, const char *name);
+netdev_item_t *netdev_table_get_by_mac(const netdev_table_t *table, const uint8_t *mac);
+
+unsigned int netdev_item_changes(const netdev_item_t *a, const netdev_item_t *b);
+int netdev_table_diff(netdev_table_t *old, netdev_table_t *new, netdev_diff_cb cb, void *arg);
+
+/* the initial dump already carries the optional NETDEV_F_* fields */
+int nl_cache_open(nl_cache_t *cache, unsigned int fields);
+void nl_cache_close(nl_cache_t *cache);
+int nl_cache_fd(nl_cache_t *cache);
+int nl_cache_update(nl_cache_t *cache);
+void nl_cache_set_cb(nl_cache_t *cache, netdev_diff_cb cb, void *arg);
+/* change the optional NETDEV_F_* fields and dump again to fill them in */
+int nl_cache_set_fields(nl_cache_t *cache, unsigned int fields);
+/* SO_RCVBUFFORCE with CAP_NET_ADMIN, otherwise SO_RCVBUF up to rmem_max */
+int nl_cache_set_rcvbuf(nl_cache_t *cache, int bytes);
+const nl_cache_stats_t *nl_cache_stats(const nl_cache_t *cache);
+
 int get_netdev(struct slist_head *list);
-netdev_item_t *ll_get_by_index(struct slist_head *list, int index);
+/* plain list lookups for existing callers, each one walks the list. A bare
+ * list has nowhere to keep an index: for O(1) lookups build a netdev_table_t
+ * and use netdev_table_get_by_*() */
+netdev_item_t *ll_get_by_index(const struct slist_head *list, int index);
+netdev_item_t *ll_get_by_name(const struct slist_head *list, const char *name);
+netdev_item_t *ll_get_by_mac(const struct slist_head *list, const uint8_t *mac);
 void free_netdev_list(struct slist_head *list);
 
 #endif // NETLINK_GET_ADDR_LIBNL_GETLINK_H
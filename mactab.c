@@ -0,0 +1,220 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libnl_getlink.h"
+#include "mactab.h"
+#include "syslog.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MACTAB_X86
+#endif
+
+#include "leak_detector_c.h"
+
+/* widest vector, buckets are padded to it so no loop needs a tail */
+#define MACTAB_LANES 8
+/* average devices per bucket, one vector holds the bucket most of the time */
+#define MACTAB_LOAD 4
+
+typedef void (*mactab_fn)(const netdev_mactab_t *tab, const uint8_t (*macs)[ETH_ALEN], size_t n, int *out);
+
+static inline void mac_split(const uint8_t *mac, uint32_t *lo, uint16_t *hi) {
+  memcpy(lo, mac, sizeof(*lo));
+  memcpy(hi, mac + sizeof(*lo), sizeof(*hi));
+}
+
+static inline uint32_t mac_bucket(const netdev_mactab_t *tab, uint32_t lo, uint16_t hi) {
+  return (uint32_t)(((uint64_t)hi << 32 | lo) * 0x9e3779b97f4a7c15ull >> 32) & tab->mask;
+}
+
+int netdev_mactab_build(netdev_mactab_t *tab, netdev_table_t *table) {
+  FUNC_START_DEBUG;
+  static const uint8_t zero[ETH_ALEN];
+  netdev_item_t *item;
+  uint32_t *pos = NULL;
+
+  memset(tab, 0, sizeof(*tab));
+  while ((tab->mask + 1) * MACTAB_LOAD < table->count) tab->mask = 2 * tab->mask + 1;
+  tab->off = calloc(tab->mask + 2, sizeof(*tab->off));
+  pos = calloc(tab->mask + 1, sizeof(*pos));
+  if (!tab->off || !pos) goto fail;
+
+  /* bucket sizes, then offsets padded to whole vectors */
+  slist_for_each_entry(item, &table->list, list) {
+    uint32_t lo;
+    uint16_t hi;
+    if (!memcmp(item->ll_addr, zero, ETH_ALEN)) continue;
+    mac_split(item->ll_addr, &lo, &hi);
+    pos[mac_bucket(tab, lo, hi)]++;
+  }
+  for (uint32_t b = 0; b <= tab->mask; b++) {
+    tab->off[b + 1] = tab->off[b] + (pos[b] + MACTAB_LANES - 1) / MACTAB_LANES * MACTAB_LANES;
+    pos[b] = tab->off[b];
+  }
+  tab->cap = tab->off[tab->mask + 1];
+
+  tab->lo = calloc(tab->cap ? tab->cap : 1, sizeof(*tab->lo));
+  tab->hi = calloc(tab->cap ? tab->cap : 1, sizeof(*tab->hi));
+  tab->index = calloc(tab->cap ? tab->cap : 1, sizeof(*tab->index));
+  if (!tab->lo || !tab->hi || !tab->index) goto fail;
+
+  /* table order within a bucket, the first owner of a MAC is found first */
+  slist_for_each_entry(item, &table->list, list) {
+    uint32_t lo;
+    uint16_t hi;
+    if (!memcmp(item->ll_addr, zero, ETH_ALEN)) continue;
+    mac_split(item->ll_addr, &lo, &hi);
+    uint32_t i = pos[mac_bucket(tab, lo, hi)]++;
+    tab->lo[i] = lo;
+    tab->hi[i] = hi;
+    tab->index[i] = item->index;
+    tab->count++;
+  }
+  free(pos);
+  return 0;
+
+fail:
+  syslog2(LOG_ALERT, "Failed to allocate memory for the MACs of %zu devices.", table->count);
+  free(pos);
+  netdev_mactab_free(tab);
+  errno = ENOMEM;
+  return -1;
+}
+
+void netdev_mactab_free(netdev_mactab_t *tab) {
+  FUNC_START_DEBUG;
+  free(tab->off);
+  free(tab->lo);
+  free(tab->hi);
+  free(tab->index);
+  memset(tab, 0, sizeof(*tab));
+}
+
+/* the padding is zero and so are the MACs of no device, a zero query is a miss */
+static void lookup_scalar(const netdev_mactab_t *tab, const uint8_t (*macs)[ETH_ALEN], size_t n, int *out) {
+  for (size_t q = 0; q < n; q++) {
+    uint32_t lo;
+    uint16_t hi;
+    mac_split(macs[q], &lo, &hi);
+    out[q] = 0;
+    if (!lo && !hi) continue;
+
+    uint32_t b = mac_bucket(tab, lo, hi);
+    for (uint32_t i = tab->off[b]; i < tab->off[b + 1]; i++) {
+      if (tab->lo[i] == lo && tab->hi[i] == hi) {
+        out[q] = tab->index[i];
+        break;
+      }
+    }
+  }
+}
+
+#ifdef MACTAB_X86
+/* SSE2 has no 64 bit compare, the halves are compared as 32 bit lanes with
+ * hi widened to match */
+__attribute__((target("sse2"))) static void lookup_sse2(const netdev_mactab_t *tab, const uint8_t (*macs)[ETH_ALEN], size_t n, int *out) {
+  const __m128i zero = _mm_setzero_si128();
+
+  for (size_t q = 0; q < n; q++) {
+    uint32_t lo;
+    uint16_t hi;
+    mac_split(macs[q], &lo, &hi);
+    out[q] = 0;
+    if (!lo && !hi) continue;
+
+    const __m128i qlo = _mm_set1_epi32(lo);
+    const __m128i qhi = _mm_set1_epi32(hi);
+    uint32_t b = mac_bucket(tab, lo, hi);
+    for (uint32_t i = tab->off[b]; i < tab->off[b + 1]; i += MACTAB_LANES) {
+      __m128i h = _mm_loadu_si128((const __m128i *)(tab->hi + i));
+      __m128i m0 = _mm_and_si128(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)(tab->lo + i)), qlo),
+                                 _mm_cmpeq_epi32(_mm_unpacklo_epi16(h, zero), qhi));
+      __m128i m1 = _mm_and_si128(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)(tab->lo + i + 4)), qlo),
+                                 _mm_cmpeq_epi32(_mm_unpackhi_epi16(h, zero), qhi));
+      int mask = _mm_movemask_ps(_mm_castsi128_ps(m0)) | _mm_movemask_ps(_mm_castsi128_ps(m1)) << 4;
+      if (mask) {
+        out[q] = tab->index[i + __builtin_ctz(mask)];
+        break;
+      }
+    }
+  }
+}
+
+__attribute__((target("avx2"))) static void lookup_avx2(const netdev_mactab_t *tab, const uint8_t (*macs)[ETH_ALEN], size_t n, int *out) {
+  for (size_t q = 0; q < n; q++) {
+    uint32_t lo;
+    uint16_t hi;
+    mac_split(macs[q], &lo, &hi);
+    out[q] = 0;
+    if (!lo && !hi) continue;
+
+    const __m256i qlo = _mm256_set1_epi32(lo);
+    const __m256i qhi = _mm256_set1_epi32(hi);
+    uint32_t b = mac_bucket(tab, lo, hi);
+    for (uint32_t i = tab->off[b]; i < tab->off[b + 1]; i += MACTAB_LANES) {
+      __m256i l = _mm256_loadu_si256((const __m256i *)(tab->lo + i));
+      __m256i h = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(tab->hi + i)));
+      __m256i m = _mm256_and_si256(_mm256_cmpeq_epi32(l, qlo), _mm256_cmpeq_epi32(h, qhi));
+      int mask = _mm256_movemask_ps(_mm256_castsi256_ps(m));
+      if (mask) {
+        out[q] = tab->index[i + __builtin_ctz(mask)];
+        break;
+      }
+    }
+  }
+}
+#endif
+
+static mactab_fn lookup_fn = lookup_scalar;
+static const char *lookup_name = "scalar";
+static pthread_once_t lookup_once = PTHREAD_ONCE_INIT;
+
+static int mactab_select(netdev_mac_impl_t impl) {
+  switch (impl) {
+  case NETDEV_MAC_AUTO:
+    if (mactab_select(NETDEV_MAC_AVX2) && mactab_select(NETDEV_MAC_SSE2)) mactab_select(NETDEV_MAC_SCALAR);
+    return 0;
+  case NETDEV_MAC_SCALAR:
+    lookup_fn = lookup_scalar;
+    lookup_name = "scalar";
+    return 0;
+#ifdef MACTAB_X86
+  case NETDEV_MAC_SSE2:
+    if (!__builtin_cpu_supports("sse2")) break;
+    lookup_fn = lookup_sse2;
+    lookup_name = "sse2";
+    return 0;
+  case NETDEV_MAC_AVX2:
+    if (!__builtin_cpu_supports("avx2")) break;
+    lookup_fn = lookup_avx2;
+    lookup_name = "avx2";
+    return 0;
+#endif
+  default:
+    break;
+  }
+  errno = ENOTSUP;
+  return -1;
+}
+
+static void lookup_auto(void) {
+  mactab_select(NETDEV_MAC_AUTO);
+}
+
+int netdev_mactab_use(netdev_mac_impl_t impl) {
+  pthread_once(&lookup_once, lookup_auto);
+  return mactab_select(impl);
+}
+
+const char *netdev_mactab_impl_name(void) {
+  pthread_once(&lookup_once, lookup_auto);
+  return lookup_name;
+}
+
+void netdev_mactab_lookup(const netdev_mactab_t *tab, const uint8_t (*macs)[ETH_ALEN], size_t n, int *out) {
+  pthread_once(&lookup_once, lookup_auto);
+  lookup_fn(tab, macs, n, out);
+}
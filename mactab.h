@@ -0,0 +1,43 @@
+#ifndef NETLINK_GET_ADDR_MACTAB_H
+#define NETLINK_GET_ADDR_MACTAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "libnl_getlink.h"
+
+/* batch MAC -> ifindex lookup. The MACs of one table snapshot are packed
+ * into two parallel arrays, the first 4 bytes and the last 2, so one vector
+ * compare checks 4 (SSE2) or 8 (AVX2) devices against a query. Devices are
+ * grouped into hash buckets of a few MACs, each padded to a whole AVX2
+ * vector, so a lookup is usually a single compare whatever the table size. */
+typedef enum netdev_mac_impl {
+  NETDEV_MAC_AUTO, /* best the CPU supports */
+  NETDEV_MAC_SCALAR,
+  NETDEV_MAC_SSE2,
+  NETDEV_MAC_AVX2,
+} netdev_mac_impl_t;
+
+typedef struct netdev_mactab {
+  size_t count;  /* devices with a MAC */
+  size_t cap;    /* slots, the padding is zero */
+  uint32_t mask; /* buckets - 1 */
+  uint32_t *off; /* mask + 2 slot offsets, bucket b is off[b] .. off[b + 1] - 1 */
+  uint32_t *lo;  /* mac[0..3] */
+  uint16_t *hi;  /* mac[4..5] */
+  int *index;
+} netdev_mactab_t;
+
+/* devices without a MAC (all zero) are left out, the first device in table
+ * order wins when several share one (bridge and its first port) */
+int netdev_mactab_build(netdev_mactab_t *tab, netdev_table_t *table);
+void netdev_mactab_free(netdev_mactab_t *tab);
+/* out[i] is the ifindex of macs[i], 0 if no device has it */
+void netdev_mactab_lookup(const netdev_mactab_t *tab, const uint8_t (*macs)[ETH_ALEN], size_t n, int *out);
+
+/* pick the compare loop for every later lookup, -1 with ENOTSUP if the CPU
+ * lacks it */
+int netdev_mactab_use(netdev_mac_impl_t impl);
+const char *netdev_mactab_impl_name(void);
+
+#endif // NETLINK_GET_ADDR_MACTAB_H
@@ -1,10 +1,19 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include "libnl_getlink.h"
+#include "export.h"
+#include "nlrecord.h"
 #include "slist.h"
 #include "syslog.h"
+#include "topo.h"
 
 #include "leak_detector_c.h"
 
@@ -72,29 +81,27 @@ static void free_netdev_list3(struct slist_head *list) {
   }
 }
 
-int main() {
-  setup_syslog2(LOG_NOTICE, false);
-
-  struct slist_head list;
-  INIT_SLIST_HEAD(&list);
-  get_netdev(&list);
+static void print_stats(FILE *out, const nl_stats_t *st) {
+  fprintf(out, "requests: %" PRIu64 " completed: %" PRIu64 " failed: %" PRIu64 " restarts: %" PRIu64 " timeouts: %" PRIu64 "\n",
+         st->requests, st->completed, st->failed, st->restarts, st->timeouts);
+  fprintf(out, "datagrams: %" PRIu64 " bytes: %" PRIu64 " truncated: %" PRIu64 " messages: %" PRIu64 " errors: %" PRIu64 "\n",
+         st->datagrams, st->bytes, st->truncated, st->messages, st->errors);
+  fprintf(out, "devices: %" PRIu64 " skipped: %" PRIu64 "\n", st->devices, st->skipped);
+  fprintf(out, "%-8s %8s %10s %10s %10s %10s %10s\n", "phase", "count", "avg ns", "p50 ns", "p90 ns", "p99 ns", "max ns");
+  for (int p = 0; p < NL_PHASE_MAX; p++) {
+    const nl_hist_t *h = &st->phase[p];
+    fprintf(out, "%-8s %8" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 "\n", nl_phase_name(p), h->count,
+           h->count ? h->sum_ns / h->count : 0, nl_hist_quantile(h, 0.5), nl_hist_quantile(h, 0.9), nl_hist_quantile(h, 0.99), h->max_ns);
+  }
+}
 
+static void print_table(netdev_table_t *table, netdev_topo_t *topo) {
   netdev_item_t *item;
   netdev_item_t *master_dev, *link_dev;
 
-  slist_for_each_entry(item, &list, list) {
-
-    if (item->master_idx > 0) {
-      master_dev = ll_get_by_index(&list, item->master_idx);
-    } else {
-      master_dev = NULL;
-    }
-
-    if (item->ifla_link_idx > 0) {
-      link_dev = ll_get_by_index(&list, item->ifla_link_idx);
-    } else {
-      link_dev = NULL;
-    }
+  slist_for_each_entry(item, &table->list, list) {
+    master_dev = netdev_topo_master(topo, item->index);
+    link_dev = netdev_topo_lower(topo, item->index);
 
     uint8_t *addr_raw = item->ll_addr;
     printf("%3d: "                                 // индекс (3 символа)
@@ -111,15 +118,331 @@ int main() {
            item->kind, item->name,
            addr_raw[0], addr_raw[1], addr_raw[2], addr_raw[3], addr_raw[4], addr_raw[5]);
   }
-  free_netdev_list(&list);
+}
+
+/* bridge and bond members, one line per master */
+static void print_ports(netdev_table_t *table, netdev_topo_t *topo) {
+  netdev_item_t *item;
+
+  slist_for_each_entry(item, &table->list, list) {
+    size_t nports;
+    netdev_item_t *const *ports = netdev_topo_ports(topo, item->index, &nports);
+    if (!nports) continue;
+    printf("%s ports:", item->name);
+    for (size_t i = 0; i < nports; i++) {
+      printf(" %s", ports[i]->name);
+    }
+    printf("\n");
+  }
+}
+
+static int export_table(netdev_table_t *table, netdev_topo_t *topo, export_fmt_t format, const export_fields_t *fields) {
+  netdev_item_t *item;
+  export_t ex;
+
+  fflush(stdout); /* the export writes to the descriptor directly */
+  int ret = export_open(&ex, STDOUT_FILENO, format, fields, topo);
+  slist_for_each_entry(item, &table->list, list) {
+    if (ret) break;
+    ret = export_dev(&ex, item);
+  }
+  if (export_close(&ex)) ret = -1;
+  return ret;
+}
+
+/* monitor: initial table, then one line per link event as it arrives */
+typedef struct monitor {
+  const nl_cache_t *cache; /* stamp is the kernel time of the event */
+  bool json;
+  uint64_t events;
+  nl_hist_t latency; /* kernel queued the notification -> line written */
+} monitor_t;
+
+static volatile sig_atomic_t stop;
 
-  get_netdev(&list);
-  free_netdev_list2(&list);
+static void on_signal(int sig) {
+  stop = 1;
+}
+
+static const char *event_name(netdev_diff_t what) {
+  switch (what) {
+  case NETDEV_DIFF_ADDED: return "add";
+  case NETDEV_DIFF_REMOVED: return "del";
+  case NETDEV_DIFF_CHANGED: return "change";
+  }
+  return "unknown";
+}
+
+static void print_mac(const uint8_t *mac, bool json) {
+  printf(json ? "\"%02x:%02x:%02x:%02x:%02x:%02x\"" : "%02x:%02x:%02x:%02x:%02x:%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+}
+
+/* name or kind, escaped in json */
+static void print_str(const monitor_t *mon, const char *str) {
+  char buf[EXPORT_JSON_STR_SIZE(IFNAMSIZ + 1)];
+  fputs(mon->json ? export_json_str(buf, str) : str, stdout);
+}
+
+/* one changed field as "name old -> new", or "name":[old,new] inside "changed" in json */
+static void print_change(monitor_t *mon, unsigned int bit, bool first, const netdev_item_t *a, const netdev_item_t *b) {
+  static const char *names[] = {"name", "mac", "master", "link", "kind", "mtu", "flags", "operstate", "txqlen"};
+  unsigned int i = __builtin_ctz(bit);
+  uint32_t x = 0, y = 0;
+
+  if (mon->json) {
+    printf("%s\"%s\":[", first ? "" : ",", names[i]);
+  } else {
+    printf(" %s ", names[i]);
+  }
+  switch (bit) {
+  case NETDEV_CHG_NAME:
+  case NETDEV_CHG_KIND:
+    print_str(mon, bit == NETDEV_CHG_NAME ? a->name : a->kind);
+    printf(mon->json ? "," : " -> ");
+    print_str(mon, bit == NETDEV_CHG_NAME ? b->name : b->kind);
+    if (mon->json) printf("]");
+    return;
+  case NETDEV_CHG_MAC:
+    print_mac(a->ll_addr, mon->json);
+    printf(mon->json ? "," : " -> ");
+    print_mac(b->ll_addr, mon->json);
+    if (mon->json) printf("]");
+    return;
+  case NETDEV_CHG_MASTER: x = a->master_idx, y = b->master_idx; break;
+  case NETDEV_CHG_LINK: x = a->ifla_link_idx, y = b->ifla_link_idx; break;
+  case NETDEV_CHG_MTU: x = a->mtu, y = b->mtu; break;
+  case NETDEV_CHG_FLAGS: x = a->flags, y = b->flags; break;
+  case NETDEV_CHG_OPERSTATE: x = a->operstate, y = b->operstate; break;
+  case NETDEV_CHG_TXQLEN: x = a->txqlen, y = b->txqlen; break;
+  }
+  printf(mon->json ? "%" PRIu32 ",%" PRIu32 "]" : (bit == NETDEV_CHG_FLAGS ? "0x%" PRIx32 " -> 0x%" PRIx32 : "%" PRIu32 " -> %" PRIu32), x, y);
+}
+
+/* nl_cache_t callback, one line per event */
+static int monitor_event(netdev_diff_t what, const netdev_item_t *old, const netdev_item_t *new, unsigned int changed, void *arg) {
+  monitor_t *mon = arg;
+  const netdev_item_t *dev = new ? new : old;
+  const struct timespec *ts = &mon->cache->stamp;
+
+  if (mon->json) {
+    printf("{\"time\":%lld.%09ld,\"event\":\"%s\",\"index\":%d,\"name\":", (long long)ts->tv_sec, ts->tv_nsec, event_name(what), dev->index);
+    print_str(mon, dev->name);
+  } else {
+    struct tm tm;
+    char buf[32];
+    localtime_r(&ts->tv_sec, &tm);
+    strftime(buf, sizeof(buf), "%H:%M:%S", &tm);
+    printf("%s.%09ld %-6s %3d %-15s", buf, ts->tv_nsec, event_name(what), dev->index, dev->name);
+  }
+
+  if (what == NETDEV_DIFF_ADDED) {
+    printf(mon->json ? ",\"kind\":" : " kind ");
+    print_str(mon, dev->kind);
+    printf(mon->json ? ",\"mac\":" : " mac ");
+    print_mac(dev->ll_addr, mon->json);
+    printf(mon->json ? ",\"master\":%d,\"link\":%d,\"mtu\":%" PRIu32 : " master %d link %d mtu %" PRIu32, dev->master_idx, dev->ifla_link_idx, dev->mtu);
+  }
+  /* json keeps them apart from the device keys, "name" is both */
+  if (changed && mon->json) printf(",\"changed\":{");
+  for (unsigned int m = changed; m; m &= m - 1) print_change(mon, m & -m, m == changed, old, new);
+  if (changed && mon->json) printf("}");
+
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  int64_t ns = (int64_t)(now.tv_sec - ts->tv_sec) * 1000000000 + (now.tv_nsec - ts->tv_nsec);
+  if (ns < 0) ns = 0;
+  nl_hist_add(&mon->latency, ns);
+  mon->events++;
+  printf(mon->json ? ",\"latency_us\":%" PRId64 "}\n" : " (%" PRId64 " us)\n", ns / 1000);
+  return 0;
+}
+
+static int monitor(export_fmt_t format, bool export, const export_fields_t *fields, bool stats) {
+  nl_cache_t cache;
+  monitor_t mon = {.cache = &cache, .json = export && format == EXPORT_JSON};
+
+  struct sigaction sa = {.sa_handler = on_signal};
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  /* events are written in batches, one flush per wakeup */
+  setvbuf(stdout, NULL, _IOFBF, 1 << 16);
+
+  if (nl_cache_open(&cache, NETDEV_F_MTU | NETDEV_F_FLAGS | NETDEV_F_OPERSTATE | NETDEV_F_TXQLEN)) return -1;
+
+  netdev_topo_t topo;
+  if (netdev_topo_build(&topo, &cache.table)) {
+    nl_cache_close(&cache);
+    return -1;
+  }
+  int ret = 0;
+  if (export) {
+    ret = export_table(&cache.table, &topo, format, fields);
+  } else {
+    print_table(&cache.table, &topo);
+  }
+  netdev_topo_free(&topo);
+  fflush(stdout);
+  nl_cache_set_cb(&cache, monitor_event, &mon);
+
+  struct pollfd pfd = {.fd = nl_cache_fd(&cache), .events = POLLIN};
+  while (!ret && !stop) {
+    int n = poll(&pfd, 1, -1);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      syslog2(LOG_ERR, "%s poll()", strerror(errno));
+      ret = -1;
+      break;
+    }
+    if (nl_cache_update(&cache) < 0) ret = -1;
+    fflush(stdout);
+  }
+
+  const nl_hist_t *h = &mon.latency;
+  fprintf(stderr, "events: %" PRIu64 " latency us p50: %" PRIu64 " p90: %" PRIu64 " p99: %" PRIu64 " max: %" PRIu64 "\n", mon.events,
+          nl_hist_quantile(h, 0.5) / 1000, nl_hist_quantile(h, 0.9) / 1000, nl_hist_quantile(h, 0.99) / 1000, h->max_ns / 1000);
+  const nl_cache_stats_t *cs = nl_cache_stats(&cache);
+  fprintf(stderr, "overruns: %" PRIu64 " truncated: %" PRIu64 " resyncs: %" PRIu64 " discarded: %" PRIu64 " resync us p50: %" PRIu64 " max: %" PRIu64 "\n",
+          cs->overruns, cs->truncated, cs->resyncs, cs->discarded, nl_hist_quantile(&cs->resync, 0.5) / 1000, cs->resync.max_ns / 1000);
+  if (stats) print_stats(stderr, nl_ctx_stats(&cache.ctx));
+  nl_cache_close(&cache);
+  return ret;
+}
+
+static void usage(void) {
+  fprintf(stdout, "Usage: getlink [record FILE | replay FILE [mmap] | monitor] [format json|csv|bin] [fields LIST] [ports] [stats]\n"
+                  "  record FILE  save the netlink traffic to FILE\n"
+                  "  replay FILE  answer from a recording instead of the kernel\n"
+                  "  mmap         map the recording instead of reading it\n"
+                  "  monitor      print the table, then link events until interrupted,\n"
+                  "               as text or with format json, latency summary on stderr\n"
+                  "  format FMT   machine readable output instead of the table\n"
+                  "  fields LIST  comma separated: index,name,kind,mac,master,master_name,\n"
+                  "               link,link_name,bridge,mtu,flags,operstate,txqlen or all\n"
+                  "  ports        list the ports of each master after the table\n"
+                  "  stats        print request counters and phase latencies\n");
+}
+
+int main(int argc, char **argv) {
+  const char *record = NULL, *replay = NULL;
+  unsigned int replay_flags = 0;
+  bool stats = false, mon = false, ports = false;
+  int format = -1;
+  export_fields_t fields;
+
+  export_fields_mask(&fields, EXPORT_F_DEFAULT);
+  while (NEXT_ARG_OK()) {
+    NEXT_ARG();
+    if (matches(*argv, "record")) {
+      NEXT_ARG();
+      record = *argv;
+    } else if (matches(*argv, "replay")) {
+      NEXT_ARG();
+      replay = *argv;
+    } else if (matches(*argv, "mmap")) {
+      replay_flags |= NLREC_MMAP;
+    } else if (matches(*argv, "format")) {
+      NEXT_ARG();
+      format = export_parse_format(*argv);
+      if (format < 0) {
+        fprintf(stdout, "Unknown format \"%s\". Try -h or --help\n", *argv);
+        return -1;
+      }
+    } else if (matches(*argv, "fields")) {
+      NEXT_ARG();
+      if (export_parse_fields(*argv, &fields)) {
+        fprintf(stdout, "Bad field list \"%s\". Try -h or --help\n", *argv);
+        return -1;
+      }
+    } else if (matches(*argv, "ports")) {
+      ports = true;
+    } else if (matches(*argv, "monitor")) {
+      mon = true;
+    } else if (matches(*argv, "stats")) {
+      stats = true;
+    } else if (matches(*argv, "help") || !strcmp(*argv, "-h") || !strcmp(*argv, "--help")) {
+      usage();
+      return 0;
+    } else {
+      fprintf(stdout, "Unknown argument \"%s\". Try -h or --help\n", *argv);
+      return -1;
+    }
+  }
+
+  setup_syslog2(LOG_NOTICE, false);
+
+  if (mon) {
+    if (record || replay) {
+      fprintf(stdout, "monitor reads the kernel directly, no record or replay. Try -h or --help\n");
+      return -1;
+    }
+    if (format >= 0 && format != EXPORT_JSON) {
+      fprintf(stdout, "monitor prints text or json. Try -h or --help\n");
+      return -1;
+    }
+    int ret = monitor(format, format >= 0, &fields, stats);
+#ifdef LEAKCHECK
+    report_mem_leak();
+#endif
+    return ret;
+  }
+
+  nl_ctx_t ctx;
+  if (replay ? nl_ctx_open_replay(&ctx, replay, replay_flags) : nl_ctx_open(&ctx)) return -1;
+  if (record && nl_ctx_record(&ctx, record)) {
+    nl_ctx_close(&ctx);
+    return -1;
+  }
+
+  netdev_table_t table;
+  if (netdev_table_init(&table)) {
+    nl_ctx_close(&ctx);
+    return -1;
+  }
+  if (format >= 0) nl_ctx_set_fields(&ctx, export_netdev_fields(fields.mask));
+  /* an empty table or export would look like a host without links */
+  if (get_netdev_table(&ctx, &table)) {
+    syslog2(LOG_ERR, "%s get_netdev_table(%s)", strerror(errno), replay ? replay : "kernel");
+    netdev_table_free(&table);
+    nl_ctx_close(&ctx);
+    return -1;
+  }
+
+  netdev_topo_t topo;
+  if (netdev_topo_build(&topo, &table)) {
+    netdev_table_free(&table);
+    nl_ctx_close(&ctx);
+    return -1;
+  }
+
+  int ret = 0;
+  if (format >= 0) {
+    ret = export_table(&table, &topo, format, &fields);
+  } else {
+    print_table(&table, &topo);
+    if (ports) print_ports(&table, &topo);
+  }
+  netdev_topo_free(&topo);
+  netdev_table_free(&table);
+
+  if (format < 0) {
+    struct slist_head list;
+    INIT_SLIST_HEAD(&list);
+    get_netdev_ctx(&ctx, &list);
+    free_netdev_list(&list);
+
+    get_netdev_ctx(&ctx, &list);
+    free_netdev_list2(&list);
+
+    get_netdev_ctx(&ctx, &list);
+    free_netdev_list3(&list);
+  }
 
-  get_netdev(&list);
-  free_netdev_list3(&list);
+  /* keep machine readable stdout clean */
+  if (stats) print_stats(format >= 0 ? stderr : stdout, nl_ctx_stats(&ctx));
+  nl_ctx_close(&ctx);
 
 #ifdef LEAKCHECK
   report_mem_leak();
 #endif
+  return ret;
 }
\ No newline at end of file
@@ -0,0 +1,193 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h> // setns(), CLONE_NEWNET
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "libnl_getlink.h"
+#include "netns.h"
+#include "syslog.h"
+
+#include "leak_detector_c.h"
+
+typedef struct netns_list {
+  netns_dump_t *ns;
+  size_t count;
+  size_t cap;
+} netns_list_t;
+
+typedef struct netns_job {
+  netns_list_t *list;
+  const netns_opts_t *opts;
+  atomic_size_t next; /* next namespace to dump */
+} netns_job_t;
+
+/* add path unless its namespace is already known */
+static int ns_add(netns_list_t *list, const char *name, const char *path) {
+  struct stat st;
+  if (stat(path, &st) < 0) return 0; /* process gone, stale entry */
+
+  for (size_t i = 0; i < list->count; i++) {
+    if (list->ns[i].dev == st.st_dev && list->ns[i].ino == st.st_ino) return 0;
+  }
+
+  if (list->count == list->cap) {
+    size_t cap = list->cap ? 2 * list->cap : 16;
+    netns_dump_t *tmp = realloc(list->ns, cap * sizeof(*tmp));
+    if (!tmp) {
+      syslog2(LOG_ALERT, "Failed to allocate memory for %zu namespaces.", cap);
+      return -1;
+    }
+    list->ns = tmp;
+    list->cap = cap;
+  }
+
+  netns_dump_t *ns = &list->ns[list->count++];
+  memset(ns, 0, sizeof(*ns));
+  snprintf(ns->name, sizeof(ns->name), "%s", name);
+  snprintf(ns->path, sizeof(ns->path), "%s", path);
+  ns->dev = st.st_dev;
+  ns->ino = st.st_ino;
+  return 0;
+}
+
+/* own namespace, named ones (ip netns) and optionally those of running processes */
+static int ns_enumerate(netns_list_t *list, bool scan_proc) {
+  char path[PATH_MAX];
+  struct dirent *de;
+  DIR *dir;
+
+  if (ns_add(list, "self", "/proc/self/ns/net")) return -1;
+
+  dir = opendir(NETNS_RUN_DIR);
+  if (dir) {
+    while ((de = readdir(dir))) {
+      if (de->d_name[0] == '.') continue;
+      snprintf(path, sizeof(path), "%s/%s", NETNS_RUN_DIR, de->d_name);
+      if (ns_add(list, de->d_name, path)) break;
+    }
+    closedir(dir);
+  }
+
+  if (!scan_proc) return 0;
+
+  dir = opendir("/proc");
+  if (!dir) return 0;
+  while ((de = readdir(dir))) {
+    char *end;
+    long pid = strtol(de->d_name, &end, 10);
+    if (*end || pid <= 0) continue;
+    char name[NAME_MAX + 1];
+    snprintf(name, sizeof(name), "pid:%ld", pid);
+    snprintf(path, sizeof(path), "/proc/%ld/ns/net", pid);
+    if (ns_add(list, name, path)) break;
+  }
+  closedir(dir);
+  return 0;
+}
+
+/* enter the namespace on this thread and dump it */
+static int ns_dump(netns_dump_t *ns, const netns_opts_t *opts) {
+  nl_ctx_t ctx;
+  int fd = open(ns->path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return -1;
+  if (setns(fd, CLONE_NEWNET) < 0) {
+    syslog2(LOG_ERR, "%s setns(%s)", strerror(errno), ns->path);
+    close(fd);
+    return -1;
+  }
+  close(fd);
+
+  /* the socket belongs to the namespace of the thread creating it */
+  if (nl_ctx_open(&ctx)) return -1;
+  nl_ctx_set_fields(&ctx, opts->fields);
+  if (opts->link_types) nl_ctx_set_link_types(&ctx, opts->link_types, opts->nlink_types);
+
+  int ret = netdev_table_init(&ns->table);
+  if (!ret) ret = get_netdev_table(&ctx, &ns->table);
+  int err = errno;
+  nl_ctx_close(&ctx);
+  errno = err;
+  return ret;
+}
+
+static void *ns_worker(void *arg) {
+  netns_job_t *job = arg;
+  size_t i;
+
+  while ((i = atomic_fetch_add(&job->next, 1)) < job->list->count) {
+    netns_dump_t *ns = &job->list->ns[i];
+    if (ns_dump(ns, job->opts)) ns->status = errno ? errno : EIO;
+  }
+  return NULL;
+}
+
+int get_netdev_all_ns(const netns_opts_t *opts, netns_dump_t **out, size_t *count) {
+  FUNC_START_DEBUG;
+  static const netns_opts_t defaults = {0};
+  netns_list_t list = {0};
+  netns_job_t job;
+
+  if (!opts) opts = &defaults;
+  if (ns_enumerate(&list, opts->scan_proc)) {
+    free(list.ns);
+    return -1;
+  }
+
+  unsigned int workers = opts->workers;
+  if (!workers) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    workers = ncpu > 0 ? ncpu : 1;
+  }
+  if (workers > list.count) workers = list.count;
+
+  job.list = &list;
+  job.opts = opts;
+  atomic_init(&job.next, 0);
+
+  /* each worker moves to the namespaces it dumps, never the calling thread */
+  pthread_t *tids = calloc(workers, sizeof(pthread_t));
+  if (!tids) {
+    free(list.ns);
+    return -1;
+  }
+  unsigned int started = 0;
+  for (; started < workers; started++) {
+    if (pthread_create(&tids[started], NULL, ns_worker, &job)) {
+      syslog2(LOG_ERR, "pthread_create failed after %u workers", started);
+      break;
+    }
+  }
+  if (!started) {
+    free(tids);
+    free(list.ns);
+    errno = EAGAIN;
+    return -1;
+  }
+  for (unsigned int i = 0; i < started; i++) {
+    pthread_join(tids[i], NULL);
+  }
+  free(tids);
+
+  *out = list.ns;
+  *count = list.count;
+  return 0;
+}
+
+void free_netdev_all_ns(netns_dump_t *ns, size_t count) {
+  FUNC_START_DEBUG;
+  for (size_t i = 0; i < count; i++) {
+    netdev_table_free(&ns[i].table);
+  }
+  free(ns);
+}
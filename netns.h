@@ -0,0 +1,32 @@
+#ifndef NETLINK_GET_ADDR_NETNS_H
+#define NETLINK_GET_ADDR_NETNS_H
+
+#include <limits.h>
+#include <sys/types.h>
+
+#include "libnl_getlink.h"
+
+#define NETNS_RUN_DIR "/var/run/netns"
+
+/* links of one network namespace */
+typedef struct netns_dump {
+  char name[NAME_MAX + 1]; /* NETNS_RUN_DIR entry, "pid:<pid>" or "self" */
+  char path[PATH_MAX];     /* file opened for setns() */
+  dev_t dev;               /* namespace identity (nsfs device and inode) */
+  ino_t ino;
+  int status;              /* 0 or errno of the failed dump */
+  netdev_table_t table;
+} netns_dump_t;
+
+typedef struct netns_opts {
+  unsigned int workers;             /* threads, 0: one per online CPU */
+  unsigned int fields;              /* NETDEV_F_* as for nl_ctx_set_fields() */
+  const unsigned short *link_types; /* ARPHRD_* set, NULL: keep the default */
+  size_t nlink_types;
+  bool scan_proc;                   /* also look at /proc/<pid>/ns/net */
+} netns_opts_t;
+
+int get_netdev_all_ns(const netns_opts_t *opts, netns_dump_t **out, size_t *count);
+void free_netdev_all_ns(netns_dump_t *ns, size_t count);
+
+#endif // NETLINK_GET_ADDR_NETNS_H
@@ -0,0 +1,181 @@
+#include <linux/if.h>
+#include <linux/if_link.h>
+#include <net/if_arp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libnl_getlink.h"
+#include "nlgen.h"
+
+/* room for one link message, the VF list grows it */
+#define NLGEN_MSG_BASE 512
+#define NLGEN_VF_SIZE 64
+
+/* NULL if the attribute does not fit into max bytes of message */
+static struct rtattr *put_attr(struct nlmsghdr *nh, size_t max, int type, const void *data, size_t len) {
+  if (NLMSG_ALIGN(nh->nlmsg_len) + RTA_SPACE(len) > max) return NULL;
+  struct rtattr *rta = NLMSG_TAIL(nh);
+  rta->rta_type = type;
+  rta->rta_len = RTA_LENGTH(len);
+  if (len) memcpy(RTA_DATA(rta), data, len);
+  nh->nlmsg_len = NLMSG_ALIGN(nh->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+  return rta;
+}
+
+/* close a nest opened by put_attr(nh, type, NULL, 0) */
+static void nest_end(struct nlmsghdr *nh, struct rtattr *nest) {
+  nest->rta_len = (uint8_t *)NLMSG_TAIL(nh) - (uint8_t *)nest;
+}
+
+static int put_kind(struct nlmsghdr *nh, size_t max, const char *kind) {
+  struct rtattr *linkinfo = put_attr(nh, max, IFLA_LINKINFO, NULL, 0);
+  if (!linkinfo || !put_attr(nh, max, IFLA_INFO_KIND, kind, strlen(kind) + 1)) return -1;
+  nest_end(nh, linkinfo);
+  return 0;
+}
+
+static int put_vfs(struct nlmsghdr *nh, size_t max, int index, int num_vf) {
+  uint32_t n = num_vf;
+  if (!put_attr(nh, max, IFLA_NUM_VF, &n, sizeof(n))) return -1;
+
+  struct rtattr *list = put_attr(nh, max, IFLA_VFINFO_LIST, NULL, 0);
+  if (!list) return -1;
+  for (int vf = 0; vf < num_vf; vf++) {
+    struct ifla_vf_mac mac = {.vf = vf, .mac = {0x06, (uint8_t)vf, (uint8_t)(index >> 16), (uint8_t)(index >> 8), (uint8_t)index}};
+    struct ifla_vf_vlan vlan = {.vf = vf};
+    struct rtattr *info = put_attr(nh, max, IFLA_VF_INFO, NULL, 0);
+    if (!info || !put_attr(nh, max, IFLA_VF_MAC, &mac, sizeof(mac)) || !put_attr(nh, max, IFLA_VF_VLAN, &vlan, sizeof(vlan))) return -1;
+    nest_end(nh, info);
+  }
+  nest_end(nh, list);
+  return 0;
+}
+
+/* one link message into max bytes at p, returns its length, 0 if it does not fit */
+static size_t put_link(uint8_t *p, size_t max, const nlgen_opts_t *opts, int index) {
+  struct nlmsghdr *nh = (struct nlmsghdr *)p;
+  struct ifinfomsg *ifi = NLMSG_DATA(nh);
+  char name[IFNAMSIZ];
+  uint8_t mac[ETH_ALEN] = {0x02, 0, (uint8_t)(index >> 24), (uint8_t)(index >> 16), (uint8_t)(index >> 8), (uint8_t)index};
+  uint32_t mtu = 1500, txqlen = 1000;
+  uint8_t operstate = IF_OPER_UP;
+
+  memset(nh, 0, NLMSG_LENGTH(sizeof(*ifi)));
+  nh->nlmsg_len = NLMSG_LENGTH(sizeof(*ifi));
+  nh->nlmsg_type = RTM_NEWLINK;
+  nh->nlmsg_flags = NLM_F_MULTI;
+  ifi->ifi_type = ARPHRD_ETHER;
+  ifi->ifi_index = index;
+  ifi->ifi_flags = IFF_UP | IFF_BROADCAST | IFF_MULTICAST | IFF_RUNNING;
+
+  /* bridges first, then veth pairs and vlans on the even veth of a pair */
+  int dev = index - opts->bridges;
+  bool bridge = dev <= 0;
+  bool vlan = !bridge && (int)((uint32_t)dev * 2654435761u % 100) < opts->vlan_pct;
+  const char *kind = bridge ? "bridge" : vlan ? "vlan" : "veth";
+
+  snprintf(name, sizeof(name), "%s%d", bridge ? "br" : vlan ? "vlan" : "veth", index);
+  if (!put_attr(nh, max, IFLA_IFNAME, name, strlen(name) + 1) || !put_attr(nh, max, IFLA_ADDRESS, mac, sizeof(mac)) ||
+      !put_attr(nh, max, IFLA_MTU, &mtu, sizeof(mtu)) || !put_attr(nh, max, IFLA_TXQLEN, &txqlen, sizeof(txqlen)) ||
+      !put_attr(nh, max, IFLA_OPERSTATE, &operstate, sizeof(operstate)))
+    return 0;
+
+  if (!bridge) {
+    uint32_t link = (dev & 1) ? index + 1 : index - 1;
+    if (vlan) link = index - 1 - (dev & 1);
+    if ((int)link > opts->bridges && (int)link <= opts->nlinks && !put_attr(nh, max, IFLA_LINK, &link, sizeof(link))) return 0;
+    if (!vlan && opts->bridges) {
+      uint32_t master = 1 + dev % opts->bridges;
+      if (!put_attr(nh, max, IFLA_MASTER, &master, sizeof(master))) return 0;
+    }
+  }
+  if (put_kind(nh, max, kind)) return 0;
+  if (!bridge && !vlan && opts->num_vf && put_vfs(nh, max, index, opts->num_vf)) return 0;
+
+  return NLMSG_ALIGN(nh->nlmsg_len);
+}
+
+static int chunk_new(nlgen_chunk_t **chunks, size_t *n, size_t *cap, size_t size) {
+  if (*n == *cap) {
+    size_t c = *cap ? 2 * *cap : 16;
+    nlgen_chunk_t *tmp = realloc(*chunks, c * sizeof(*tmp));
+    if (!tmp) return -1;
+    *chunks = tmp;
+    *cap = c;
+  }
+  (*chunks)[*n].len = 0;
+  (*chunks)[*n].buf = malloc(size);
+  if (!(*chunks)[*n].buf) return -1;
+  (*n)++;
+  return 0;
+}
+
+size_t nlgen_dump(const nlgen_opts_t *opts, nlgen_chunk_t **out) {
+  size_t size = opts->chunk_size ? opts->chunk_size : NLGEN_CHUNK_SIZE;
+  nlgen_chunk_t *chunks = NULL;
+  size_t n = 0, cap = 0;
+  uint8_t *msg = NULL;
+
+  if (opts->num_vf < 0 || opts->num_vf > NLGEN_VF_MAX) {
+    fprintf(stderr, "nlgen: %d VFs, at most %d\n", opts->num_vf, NLGEN_VF_MAX);
+    return 0;
+  }
+  size_t max = NLGEN_MSG_BASE + (size_t)opts->num_vf * NLGEN_VF_SIZE;
+  msg = malloc(max); /* malloc() alignment covers NLMSG_ALIGNTO */
+  if (!msg || chunk_new(&chunks, &n, &cap, size)) goto fail;
+  for (int index = 1; index <= opts->nlinks + 1; index++) {
+    size_t len;
+    if (index <= opts->nlinks) {
+      len = put_link(msg, max, opts, index);
+      if (!len) {
+        fprintf(stderr, "nlgen: link %d does not fit in %zu bytes\n", index, max);
+        goto fail;
+      }
+    } else {
+      struct nlmsghdr *done = (struct nlmsghdr *)msg;
+      memset(done, 0, NLMSG_LENGTH(sizeof(int)));
+      done->nlmsg_len = NLMSG_LENGTH(sizeof(int));
+      done->nlmsg_type = NLMSG_DONE;
+      done->nlmsg_flags = NLM_F_MULTI;
+      len = done->nlmsg_len;
+    }
+    if (len > size) {
+      fprintf(stderr, "nlgen: %zu byte message, datagrams are %zu\n", len, size);
+      goto fail;
+    }
+    nlgen_chunk_t *c = &chunks[n - 1];
+    if (c->len + len > size) {
+      if (chunk_new(&chunks, &n, &cap, size)) goto fail;
+      c = &chunks[n - 1];
+    }
+    memcpy(c->buf + c->len, msg, len);
+    c->len += len;
+  }
+  free(msg);
+  *out = chunks;
+  return n;
+
+fail:
+  free(msg);
+  nlgen_free(chunks, n);
+  return 0;
+}
+
+void nlgen_stamp(nlgen_chunk_t *chunks, size_t n, uint32_t seq, uint32_t pid) {
+  for (size_t i = 0; i < n; i++) {
+    size_t len = chunks[i].len;
+    struct nlmsghdr *nh;
+    for (nh = (struct nlmsghdr *)chunks[i].buf; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+      nh->nlmsg_seq = seq;
+      nh->nlmsg_pid = pid;
+    }
+  }
+}
+
+void nlgen_free(nlgen_chunk_t *chunks, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    free(chunks[i].buf);
+  }
+  free(chunks);
+}
@@ -0,0 +1,32 @@
+#ifndef NETLINK_GET_ADDR_NLGEN_H
+#define NETLINK_GET_ADDR_NLGEN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* synthetic RTM_NEWLINK dump generator for benchmarks and offline runs */
+
+#define NLGEN_CHUNK_SIZE 32768 /* what the kernel puts in one dump datagram */
+#define NLGEN_VF_MAX 256       /* num_vf limit, a message must fit in one datagram */
+
+typedef struct nlgen_opts {
+  int nlinks;          /* devices in the dump, bridges included */
+  int bridges;         /* first devices are bridges, the rest are ported to them */
+  int vlan_pct;        /* share of vlans stacked on veths, the rest are veth pairs */
+  int num_vf;          /* IFLA_NUM_VF and IFLA_VFINFO_LIST entries per veth, 0: none */
+  size_t chunk_size;   /* datagram size, 0: NLGEN_CHUNK_SIZE */
+} nlgen_opts_t;
+
+typedef struct nlgen_chunk {
+  size_t len;
+  uint8_t *buf;
+} nlgen_chunk_t;
+
+/* the whole dump including NLMSG_DONE split into datagrams, 0 on failure */
+size_t nlgen_dump(const nlgen_opts_t *opts, nlgen_chunk_t **out);
+/* address the dump to the request seq of port pid */
+void nlgen_stamp(nlgen_chunk_t *chunks, size_t n, uint32_t seq, uint32_t pid);
+void nlgen_free(nlgen_chunk_t *chunks, size_t n);
+
+#endif // NETLINK_GET_ADDR_NLGEN_H
@@ -0,0 +1,273 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "libnl_getlink.h"
+#include "nlrecord.h"
+#include "syslog.h"
+
+#include "leak_detector_c.h"
+
+#define NLREC_ALIGN(len) (((len) + 3) & ~3u)
+#define NLREC_IOBUF (1 << 20)
+
+/* recorder: forwards to the transport it wraps and logs the traffic */
+typedef struct recorder {
+  const nl_transport_t *tp;
+  void *priv;
+  FILE *f;
+} recorder_t;
+
+static void rec_write(recorder_t *rec, uint16_t type, uint16_t flags, const void *buf, uint32_t len) {
+  static const uint8_t pad[4];
+  nlrec_hdr_t hdr = {.len = len, .type = type, .flags = flags};
+  uint32_t plen = flags & NLREC_F_TRUNC ? 0 : len;
+
+  if (fwrite(&hdr, sizeof(hdr), 1, rec->f) != 1 || fwrite(buf, 1, plen, rec->f) != plen ||
+      fwrite(pad, 1, NLREC_ALIGN(plen) - plen, rec->f) != NLREC_ALIGN(plen) - plen) {
+    syslog2(LOG_ERR, "%s writing recording", strerror(errno));
+  }
+}
+
+static int rec_send(void *priv, const void *buf, size_t len) {
+  recorder_t *rec = priv;
+  int ret = rec->tp->send(rec->priv, buf, len);
+  if (!ret) rec_write(rec, NLREC_SEND, 0, buf, len);
+  return ret;
+}
+
+static ssize_t rec_recv(void *priv, void **buf, size_t size) {
+  recorder_t *rec = priv;
+  void *in = *buf;
+  ssize_t len = rec->tp->recv(rec->priv, buf, size);
+  if (len > 0) rec_write(rec, NLREC_RECV, *buf == in && (size_t)len > size ? NLREC_F_TRUNC : 0, *buf, len);
+  return len;
+}
+
+static int rec_wait(void *priv, int timeout_ms) {
+  recorder_t *rec = priv;
+  return rec->tp->wait(rec->priv, timeout_ms);
+}
+
+static int rec_fd(void *priv) {
+  recorder_t *rec = priv;
+  return rec->tp->fd ? rec->tp->fd(rec->priv) : -1;
+}
+
+static void rec_close(void *priv) {
+  recorder_t *rec = priv;
+  if (fclose(rec->f)) syslog2(LOG_ERR, "%s closing recording", strerror(errno));
+  rec->tp->close(rec->priv);
+  free(rec);
+}
+
+static const nl_transport_t rec_transport = {
+    .name = "record",
+    .send = rec_send,
+    .recv = rec_recv,
+    .wait = rec_wait,
+    .fd = rec_fd,
+    .close = rec_close,
+};
+
+int nl_ctx_record(nl_ctx_t *ctx, const char *path) {
+  FUNC_START_DEBUG;
+  nlrec_file_t fh = {.magic = NLREC_MAGIC, .version = NLREC_VERSION, .pid = ctx->pid};
+  recorder_t *rec = calloc(1, sizeof(*rec));
+  if (!rec) {
+    syslog2(LOG_ALERT, "Failed to allocate memory for the recorder.");
+    return -1;
+  }
+  rec->f = fopen(path, "wbe");
+  if (!rec->f) {
+    syslog2(LOG_ERR, "%s fopen(%s)", strerror(errno), path);
+    free(rec);
+    return -1;
+  }
+  setvbuf(rec->f, NULL, _IOFBF, NLREC_IOBUF);
+  if (fwrite(&fh, sizeof(fh), 1, rec->f) != 1) {
+    syslog2(LOG_ERR, "%s writing %s", strerror(errno), path);
+    fclose(rec->f);
+    free(rec);
+    return -1;
+  }
+
+  rec->tp = ctx->tp;
+  rec->priv = ctx->tp_priv;
+  ctx->tp = &rec_transport;
+  ctx->tp_priv = rec;
+  return 0;
+}
+
+/* replay: hands out recorded replies, from a mapping or read one by one */
+typedef struct replay {
+  nl_ctx_t *ctx;
+  uint8_t *map; /* NLREC_MMAP */
+  size_t map_len;
+  size_t pos;
+  FILE *f;      /* otherwise */
+  nlrec_hdr_t next;
+  bool have_next;
+  void *buf;
+  size_t bufsize;
+} replay_t;
+
+/* type of the next record, 0 at the end of the recording */
+static int replay_peek(replay_t *rp) {
+  if (rp->map) {
+    if (rp->pos + sizeof(nlrec_hdr_t) > rp->map_len) return 0;
+    memcpy(&rp->next, rp->map + rp->pos, sizeof(rp->next));
+    size_t plen = rp->next.flags & NLREC_F_TRUNC ? 0 : rp->next.len;
+    if (rp->pos + sizeof(nlrec_hdr_t) + plen > rp->map_len) return 0;
+    return rp->next.type;
+  }
+  if (!rp->have_next) {
+    if (fread(&rp->next, sizeof(rp->next), 1, rp->f) != 1) return 0;
+    rp->have_next = true;
+  }
+  return rp->next.type;
+}
+
+/* consume the record replay_peek() looked at, returns its payload */
+static void *replay_take(replay_t *rp) {
+  uint32_t plen = rp->next.flags & NLREC_F_TRUNC ? 0 : rp->next.len;
+
+  if (rp->map) {
+    void *data = rp->map + rp->pos + sizeof(nlrec_hdr_t);
+    rp->pos += sizeof(nlrec_hdr_t) + NLREC_ALIGN(plen);
+    return data;
+  }
+
+  rp->have_next = false;
+  if (NLREC_ALIGN(plen) > rp->bufsize) {
+    void *tmp = realloc(rp->buf, NLREC_ALIGN(plen));
+    if (!tmp) return NULL;
+    rp->buf = tmp;
+    rp->bufsize = NLREC_ALIGN(plen);
+  }
+  if (fread(rp->buf, 1, NLREC_ALIGN(plen), rp->f) != NLREC_ALIGN(plen)) return NULL;
+  return rp->buf;
+}
+
+static int replay_send(void *priv, const void *buf, size_t len) {
+  replay_t *rp = priv;
+  int type;
+
+  /* replies the caller did not read belong to the previous request */
+  while ((type = replay_peek(rp)) == NLREC_RECV) {
+    if (!replay_take(rp)) break;
+  }
+  if (type != NLREC_SEND) {
+    errno = ENODATA;
+    return -1;
+  }
+  struct nlmsghdr *req = replay_take(rp);
+  if (!req || rp->next.len < sizeof(*req)) {
+    errno = EPROTO;
+    return -1;
+  }
+  /* follow the sequence numbers of the recording */
+  rp->ctx->seq = req->nlmsg_seq;
+  return 0;
+}
+
+static ssize_t replay_recv(void *priv, void **buf, size_t size) {
+  replay_t *rp = priv;
+
+  if (replay_peek(rp) != NLREC_RECV) {
+    errno = EAGAIN;
+    return -1;
+  }
+  bool trunc = rp->next.flags & NLREC_F_TRUNC;
+  ssize_t len = rp->next.len;
+  void *data = replay_take(rp);
+  if (!data) {
+    errno = EIO;
+    return -1;
+  }
+  /* a lost datagram is lost again, the dump restarts as it did then */
+  if (trunc) return (size_t)len > size ? len : (ssize_t)size + 1;
+  *buf = data;
+  return len;
+}
+
+static int replay_wait(void *priv, int timeout_ms) {
+  return replay_peek(priv) == NLREC_RECV;
+}
+
+static void replay_close(void *priv) {
+  replay_t *rp = priv;
+  if (rp->map) munmap(rp->map, rp->map_len);
+  if (rp->f) fclose(rp->f);
+  free(rp->buf);
+  free(rp);
+}
+
+static const nl_transport_t replay_transport = {
+    .name = "replay",
+    .send = replay_send,
+    .recv = replay_recv,
+    .wait = replay_wait,
+    .fd = NULL,
+    .close = replay_close,
+};
+
+int nl_ctx_open_replay(nl_ctx_t *ctx, const char *path, unsigned int flags) {
+  FUNC_START_DEBUG;
+  nlrec_file_t fh;
+  replay_t *rp = calloc(1, sizeof(*rp));
+  if (!rp) {
+    syslog2(LOG_ALERT, "Failed to allocate memory for the replay.");
+    return -1;
+  }
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    syslog2(LOG_ERR, "%s open(%s)", strerror(errno), path);
+    free(rp);
+    return -1;
+  }
+  if (read(fd, &fh, sizeof(fh)) != sizeof(fh) || fh.magic != NLREC_MAGIC || fh.version != NLREC_VERSION) {
+    syslog2(LOG_ERR, "%s is not a version %d recording", path, NLREC_VERSION);
+    close(fd);
+    free(rp);
+    errno = EPROTO;
+    return -1;
+  }
+
+  if (flags & NLREC_MMAP) {
+    struct stat st;
+    if (fstat(fd, &st) < 0) goto err;
+    rp->map_len = st.st_size;
+    rp->map = mmap(NULL, rp->map_len, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    if (rp->map == MAP_FAILED) {
+      syslog2(LOG_ERR, "%s mmap(%s)", strerror(errno), path);
+      rp->map = NULL;
+      goto err;
+    }
+    rp->pos = sizeof(fh);
+    close(fd);
+  } else {
+    rp->f = fdopen(fd, "rb");
+    if (!rp->f) goto err;
+    setvbuf(rp->f, NULL, _IOFBF, NLREC_IOBUF);
+  }
+
+  if (nl_ctx_open_transport(ctx, &replay_transport, rp)) {
+    replay_close(rp);
+    return -1;
+  }
+  rp->ctx = ctx;
+  ctx->pid = fh.pid;
+  return 0;
+
+err:
+  close(fd);
+  free(rp);
+  return -1;
+}
@@ -0,0 +1,43 @@
+#ifndef NETLINK_GET_ADDR_NLRECORD_H
+#define NETLINK_GET_ADDR_NLRECORD_H
+
+#include <stdint.h>
+
+#include "libnl_getlink.h"
+
+/* recording file: nlrec_file_t, then nlrec_hdr_t + payload records, payloads
+ * padded to 4 bytes. Requests are stored as sent, replies per datagram. */
+#define NLREC_MAGIC 0x4345524eu /* "NREC" */
+#define NLREC_VERSION 1
+
+#define NLREC_SEND 1
+#define NLREC_RECV 2
+
+typedef struct nlrec_file {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t pid; /* port id replies in the recording are addressed to */
+  uint32_t reserved;
+} nlrec_file_t;
+
+/* the datagram did not fit the receive buffer and was lost, len is its size
+ * and there is no payload */
+#define NLREC_F_TRUNC (1u << 0)
+
+typedef struct nlrec_hdr {
+  uint32_t len; /* payload bytes */
+  uint16_t type;
+  uint16_t flags;
+} nlrec_hdr_t;
+
+/* replay the file through mmap() instead of reading it record by record */
+#define NLREC_MMAP (1u << 0)
+
+/* save every request and datagram of ctx to path until nl_ctx_close() */
+int nl_ctx_record(nl_ctx_t *ctx, const char *path);
+/* handle answering requests from a recording, as fast as it can be read.
+ * The caller has to issue the same requests in the same order, and ctx must
+ * not be moved while open. */
+int nl_ctx_open_replay(nl_ctx_t *ctx, const char *path, unsigned int flags);
+
+#endif // NETLINK_GET_ADDR_NLRECORD_H
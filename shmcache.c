@@ -0,0 +1,332 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libnl_getlink.h"
+#include "shmcache.h"
+#include "syslog.h"
+
+#include "leak_detector_c.h"
+
+static size_t shm_size(uint32_t capacity) {
+  return sizeof(nl_shm_hdr_t) + (size_t)capacity * sizeof(nl_shm_dev_t);
+}
+
+/* tell the readers of a segment left under the name by an earlier writer
+ * to open it again, whatever it is gets unlinked right after */
+static void shm_retire(const char *name) {
+  struct stat st;
+
+  int fd = shm_open(name, O_RDWR | O_CLOEXEC, 0);
+  if (fd < 0) return;
+  if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(nl_shm_hdr_t)) {
+    nl_shm_hdr_t *hdr = mmap(NULL, sizeof(*hdr), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (hdr != MAP_FAILED) {
+      if (hdr->magic == NL_SHM_MAGIC && hdr->version == NL_SHM_VERSION) {
+        atomic_store_explicit(&hdr->state, NL_SHM_DEAD, memory_order_release);
+      }
+      munmap(hdr, sizeof(*hdr));
+    }
+  }
+  close(fd);
+}
+
+int nl_shm_create(nl_shm_t *shm, const char *name, uint32_t capacity) {
+  FUNC_START_DEBUG;
+  memset(shm, 0, sizeof(*shm));
+  snprintf(shm->name, sizeof(shm->name), "%s", name ? name : NL_SHM_NAME);
+  if (!capacity) capacity = NL_SHM_CAPACITY;
+  shm->size = shm_size(capacity);
+
+  shm->stage = malloc(capacity * sizeof(*shm->stage));
+  if (!shm->stage) {
+    syslog2(LOG_ALERT, "Failed to allocate memory for %u devices.", capacity);
+    return -1;
+  }
+
+  /* never truncate a live segment, readers of it would get SIGBUS. The old
+   * one stays mapped by its readers and goes away with the last of them. */
+  shm_retire(shm->name);
+  if (shm_unlink(shm->name) < 0 && errno != ENOENT) {
+    syslog2(LOG_ERR, "%s shm_unlink(%s)", strerror(errno), shm->name);
+    free(shm->stage);
+    return -1;
+  }
+  int fd = shm_open(shm->name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    syslog2(LOG_ERR, "%s shm_open(%s)", strerror(errno), shm->name);
+    free(shm->stage);
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == 0) shm->ino = st.st_ino;
+  if (ftruncate(fd, shm->size) < 0) {
+    syslog2(LOG_ERR, "%s ftruncate(%zu)", strerror(errno), shm->size);
+    close(fd);
+    shm_unlink(shm->name);
+    free(shm->stage);
+    return -1;
+  }
+  shm->hdr = mmap(NULL, shm->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (shm->hdr == MAP_FAILED) {
+    syslog2(LOG_ERR, "%s mmap()", strerror(errno));
+    shm_unlink(shm->name);
+    free(shm->stage);
+    return -1;
+  }
+
+  /* readers check magic last, it is written after the rest of the header */
+  shm->hdr->version = NL_SHM_VERSION;
+  shm->hdr->capacity = capacity;
+  shm->hdr->dev_size = sizeof(nl_shm_dev_t);
+  shm->hdr->writer_pid = getpid();
+  atomic_init(&shm->hdr->seq, 0);
+  atomic_init(&shm->hdr->state, NL_SHM_LIVE);
+  atomic_thread_fence(memory_order_release);
+  shm->hdr->magic = NL_SHM_MAGIC;
+  return 0;
+}
+
+static int dev_cmp(const void *a, const void *b) {
+  const nl_shm_dev_t *x = a, *y = b;
+  return (x->index > y->index) - (x->index < y->index);
+}
+
+int nl_shm_publish(nl_shm_t *shm, netdev_table_t *table) {
+  FUNC_START_DEBUG;
+  nl_shm_hdr_t *hdr = shm->hdr;
+  netdev_item_t *item;
+  size_t n = 0;
+
+  if (table->count > hdr->capacity) {
+    syslog2(LOG_ERR, "%zu devices do not fit into %u shared slots", table->count, hdr->capacity);
+    /* readers must not take the last snapshot that fit for the current one */
+    unsigned int live = NL_SHM_LIVE;
+    atomic_compare_exchange_strong_explicit(&hdr->state, &live, NL_SHM_STALE, memory_order_release, memory_order_relaxed);
+    errno = ENOSPC;
+    return -1;
+  }
+
+  /* build and sort outside the write section to keep readers spinning short */
+  slist_for_each_entry(item, &table->list, list) {
+    nl_shm_dev_t *d = &shm->stage[n++];
+    memset(d, 0, sizeof(*d));
+    d->index = item->index;
+    d->master_idx = item->master_idx;
+    d->ifla_link_idx = item->ifla_link_idx;
+    d->flags = item->flags;
+    d->mtu = item->mtu;
+    d->txqlen = item->txqlen;
+    d->operstate = item->operstate;
+    d->is_bridge = item->is_bridge;
+    memcpy(d->ll_addr, item->ll_addr, ETH_ALEN);
+    memcpy(d->name, item->name, sizeof(d->name));
+    memcpy(d->kind, item->kind, sizeof(d->kind));
+    d->fields = item->fields;
+  }
+  qsort(shm->stage, n, sizeof(*shm->stage), dev_cmp);
+
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+
+  unsigned int seq = atomic_load_explicit(&hdr->seq, memory_order_relaxed);
+  atomic_store_explicit(&hdr->seq, seq + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  memcpy(hdr->devs, shm->stage, n * sizeof(*shm->stage));
+  hdr->count = n;
+  hdr->generation++;
+  hdr->updated_ns = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+  atomic_store_explicit(&hdr->state, NL_SHM_LIVE, memory_order_relaxed);
+  atomic_store_explicit(&hdr->seq, seq + 2, memory_order_release);
+  return 0;
+}
+
+void nl_shm_unlink(nl_shm_t *shm) {
+  FUNC_START_DEBUG;
+  struct stat st;
+
+  /* readers stop trusting the last snapshot */
+  if (shm->hdr) atomic_store_explicit(&shm->hdr->state, NL_SHM_DEAD, memory_order_release);
+
+  /* leave the name alone if another writer has replaced the segment */
+  int fd = shm_open(shm->name, O_RDONLY | O_CLOEXEC, 0);
+  if (fd >= 0) {
+    if (fstat(fd, &st) == 0 && st.st_ino == shm->ino) shm_unlink(shm->name);
+    close(fd);
+  }
+  nl_shm_close(shm);
+}
+
+int nl_shm_open(nl_shm_t *shm, const char *name) {
+  FUNC_START_DEBUG;
+  struct stat st;
+
+  memset(shm, 0, sizeof(*shm));
+  snprintf(shm->name, sizeof(shm->name), "%s", name ? name : NL_SHM_NAME);
+  int fd = shm_open(shm->name, O_RDONLY | O_CLOEXEC, 0);
+  if (fd < 0) {
+    syslog2(LOG_ERR, "%s shm_open(%s)", strerror(errno), shm->name);
+    return -1;
+  }
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(nl_shm_hdr_t)) {
+    close(fd);
+    errno = EPROTO;
+    return -1;
+  }
+  shm->size = st.st_size;
+  shm->hdr = mmap(NULL, shm->size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (shm->hdr == MAP_FAILED) {
+    syslog2(LOG_ERR, "%s mmap()", strerror(errno));
+    shm->hdr = NULL;
+    return -1;
+  }
+
+  nl_shm_hdr_t *hdr = shm->hdr;
+  if (hdr->magic != NL_SHM_MAGIC || hdr->version != NL_SHM_VERSION || hdr->dev_size != sizeof(nl_shm_dev_t) ||
+      shm_size(hdr->capacity) > shm->size) {
+    syslog2(LOG_ERR, "%s is not a version %d link segment", shm->name, NL_SHM_VERSION);
+    nl_shm_close(shm);
+    errno = EPROTO;
+    return -1;
+  }
+  if (atomic_load_explicit(&hdr->state, memory_order_acquire) == NL_SHM_DEAD) {
+    nl_shm_close(shm);
+    errno = ESTALE;
+    return -1;
+  }
+  return 0;
+}
+
+void nl_shm_close(nl_shm_t *shm) {
+  FUNC_START_DEBUG;
+  if (shm->hdr) munmap(shm->hdr, shm->size);
+  free(shm->stage);
+  shm->hdr = NULL;
+  shm->stage = NULL;
+}
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+/* seqlock read side: wait for an even sequence, read, check it did not move.
+ * Spins without syscalls first, then yields to a writer that was preempted.
+ * A writer that died in the middle of an update is EOWNERDEAD, one that
+ * stays in it too long EAGAIN, a retired segment ESTALE and one that no
+ * longer holds every device EOVERFLOW. */
+static int read_begin(const nl_shm_hdr_t *hdr, unsigned int *seq) {
+  unsigned int state = atomic_load_explicit(&hdr->state, memory_order_acquire);
+  if (state != NL_SHM_LIVE) {
+    errno = state == NL_SHM_DEAD ? ESTALE : EOVERFLOW;
+    return -1;
+  }
+  for (unsigned int i = 0; i < NL_SHM_SPIN + NL_SHM_YIELDS; i++) {
+    *seq = atomic_load_explicit(&hdr->seq, memory_order_acquire);
+    if (!(*seq & 1)) return 0;
+    if (i < NL_SHM_SPIN) {
+      cpu_relax();
+    } else {
+      sched_yield();
+    }
+  }
+  errno = kill(hdr->writer_pid, 0) < 0 && errno == ESRCH ? EOWNERDEAD : EAGAIN;
+  return -1;
+}
+
+static bool read_retry(const nl_shm_hdr_t *hdr, unsigned int seq) {
+  atomic_thread_fence(memory_order_acquire);
+  return atomic_load_explicit(&hdr->seq, memory_order_relaxed) != seq;
+}
+
+uint64_t nl_shm_generation(const nl_shm_t *shm) {
+  uint64_t gen;
+  unsigned int seq;
+  do {
+    if (read_begin(shm->hdr, &seq)) return 0;
+    gen = shm->hdr->generation;
+  } while (read_retry(shm->hdr, seq));
+  return gen;
+}
+
+int nl_shm_read(const nl_shm_t *shm, nl_shm_dev_t *devs, size_t cap, size_t *count, uint64_t *generation) {
+  const nl_shm_hdr_t *hdr = shm->hdr;
+  unsigned int seq;
+  size_t n;
+
+  do {
+    if (read_begin(hdr, &seq)) return -1;
+    n = hdr->count;
+    if (n > hdr->capacity) continue; /* torn, read_retry() catches it */
+    memcpy(devs, hdr->devs, (n < cap ? n : cap) * sizeof(*devs));
+    if (generation) *generation = hdr->generation;
+  } while (read_retry(hdr, seq));
+
+  *count = n;
+  return 0;
+}
+
+int nl_shm_get_by_index(const nl_shm_t *shm, int index, nl_shm_dev_t *dev) {
+  const nl_shm_hdr_t *hdr = shm->hdr;
+  unsigned int seq;
+  bool found;
+
+  do {
+    if (read_begin(hdr, &seq)) return -1;
+    size_t lo = 0, hi = hdr->count < hdr->capacity ? hdr->count : hdr->capacity;
+    found = false;
+    while (lo < hi) {
+      size_t mid = lo + (hi - lo) / 2;
+      int cur = hdr->devs[mid].index;
+      if (cur == index) {
+        *dev = hdr->devs[mid];
+        found = true;
+        break;
+      }
+      if (cur < index) lo = mid + 1;
+      else hi = mid;
+    }
+  } while (read_retry(hdr, seq));
+
+  if (!found) {
+    errno = ENODEV;
+    return -1;
+  }
+  return 0;
+}
+
+int nl_shm_get_by_name(const nl_shm_t *shm, const char *name, nl_shm_dev_t *dev) {
+  const nl_shm_hdr_t *hdr = shm->hdr;
+  unsigned int seq;
+  bool found;
+
+  do {
+    if (read_begin(hdr, &seq)) return -1;
+    size_t n = hdr->count < hdr->capacity ? hdr->count : hdr->capacity;
+    found = false;
+    for (size_t i = 0; i < n; i++) {
+      if (!strncmp(hdr->devs[i].name, name, IFNAMSIZ)) {
+        *dev = hdr->devs[i];
+        found = true;
+        break;
+      }
+    }
+  } while (read_retry(hdr, seq));
+
+  if (!found) {
+    errno = ENODEV;
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,95 @@
+#ifndef NETLINK_GET_ADDR_SHMCACHE_H
+#define NETLINK_GET_ADDR_SHMCACHE_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "libnl_getlink.h"
+
+/* shm_open() name used by getlinkd unless told otherwise */
+#define NL_SHM_NAME "/nl_getlink"
+#define NL_SHM_MAGIC 0x4c474c4eu /* "NLGL" */
+#define NL_SHM_VERSION 2
+#define NL_SHM_CAPACITY 4096     /* default device slots */
+
+/* how long readers wait for an update to finish: busy loop iterations, then
+ * sched_yield() calls, before they give up */
+#ifndef NL_SHM_SPIN
+#define NL_SHM_SPIN 4096
+#endif
+#ifndef NL_SHM_YIELDS
+#define NL_SHM_YIELDS 1000
+#endif
+
+/* fixed layout device record, the segment is read by other processes */
+typedef struct nl_shm_dev {
+  int32_t index;
+  int32_t master_idx;
+  int32_t ifla_link_idx;
+  uint32_t flags;
+  uint32_t mtu;
+  uint32_t txqlen;
+  uint8_t operstate;
+  uint8_t is_bridge;
+  uint8_t ll_addr[ETH_ALEN];
+  char name[IFNAMSIZ + 1];
+  char kind[IFNAMSIZ + 1];
+  uint32_t fields; /* NETDEV_F_* valid in this record */
+} nl_shm_dev_t;
+
+/* segment state, readers fail with EOVERFLOW while it is stale and with
+ * ESTALE once it is dead */
+#define NL_SHM_LIVE 0
+#define NL_SHM_DEAD 1  /* writer exited or replaced the segment, open it again */
+#define NL_SHM_STALE 2 /* the last publish did not fit, devs[] is out of date */
+
+/* segment header, devs[] is sorted by index. seq is odd while the writer
+ * is in the middle of an update. */
+typedef struct nl_shm_hdr {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t capacity;  /* slots in devs[] */
+  uint32_t dev_size;  /* sizeof(nl_shm_dev_t) of the writer */
+  _Alignas(64) atomic_uint seq;
+  atomic_uint state;   /* NL_SHM_LIVE, NL_SHM_DEAD, NL_SHM_STALE */
+  uint32_t count;
+  uint64_t generation; /* +1 per publish */
+  uint64_t updated_ns; /* CLOCK_REALTIME of the last publish */
+  int32_t writer_pid;
+  _Alignas(64) nl_shm_dev_t devs[];
+} nl_shm_hdr_t;
+
+typedef struct nl_shm {
+  nl_shm_hdr_t *hdr;
+  size_t size;         /* mapped bytes */
+  char name[64];
+  uint64_t ino;        /* writer: inode of the segment it created */
+  nl_shm_dev_t *stage; /* writer: sorted copy built outside the write section */
+} nl_shm_t;
+
+/* writer side, used by getlinkd. A segment already under the name is
+ * marked dead and unlinked, not reused: its readers keep the old mapping
+ * and learn they have to open the name again. nl_shm_unlink() marks the
+ * writer's own segment dead the same way. */
+int nl_shm_create(nl_shm_t *shm, const char *name, uint32_t capacity);
+/* -1 with ENOSPC when the table has more devices than slots, the segment
+ * stays stale until a publish fits */
+int nl_shm_publish(nl_shm_t *shm, netdev_table_t *table);
+void nl_shm_unlink(nl_shm_t *shm);
+
+/* reader side: after nl_shm_open() no call makes a syscall unless the
+ * writer is stuck in an update. Then they fail with EAGAIN, or EOWNERDEAD
+ * when writer_pid is gone, and the segment should be opened again. ESTALE
+ * means the writer retired the segment, the name holds a new one or none,
+ * EOVERFLOW that the writer has more devices than the segment holds. */
+int nl_shm_open(nl_shm_t *shm, const char *name);
+void nl_shm_close(nl_shm_t *shm);
+/* 0 on failure */
+uint64_t nl_shm_generation(const nl_shm_t *shm);
+/* consistent copy of up to cap devices, *count is the total in the segment */
+int nl_shm_read(const nl_shm_t *shm, nl_shm_dev_t *devs, size_t cap, size_t *count, uint64_t *generation);
+int nl_shm_get_by_index(const nl_shm_t *shm, int index, nl_shm_dev_t *dev);
+int nl_shm_get_by_name(const nl_shm_t *shm, const char *name, nl_shm_dev_t *dev);
+
+#endif // NETLINK_GET_ADDR_SHMCACHE_H
@@ -0,0 +1,146 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libnl_getlink.h"
+#include "snapshot.h"
+#include "syslog.h"
+
+#include "leak_detector_c.h"
+
+int netdev_pub_init(netdev_pub_t *pub) {
+  FUNC_START_DEBUG;
+  memset(pub, 0, sizeof(*pub));
+  atomic_init(&pub->current, NULL);
+  atomic_init(&pub->epoch, 1);
+  for (size_t i = 0; i < NETDEV_PUB_READERS; i++) {
+    atomic_init(&pub->readers[i].epoch, 0);
+    atomic_init(&pub->readers[i].used, false);
+  }
+  if (pthread_mutex_init(&pub->lock, NULL)) {
+    errno = EAGAIN;
+    return -1;
+  }
+  return 0;
+}
+
+static void snap_free(netdev_snap_t *snap) {
+  netdev_table_free(&snap->table);
+  free(snap);
+}
+
+void netdev_pub_destroy(netdev_pub_t *pub) {
+  FUNC_START_DEBUG;
+  netdev_snap_t *snap = atomic_exchange(&pub->current, NULL);
+  if (snap) snap_free(snap);
+  while ((snap = pub->retired)) {
+    pub->retired = snap->next;
+    snap_free(snap);
+  }
+  pthread_mutex_destroy(&pub->lock);
+}
+
+/* oldest epoch a reader is still in, UINT64_MAX if none is reading */
+static uint64_t pub_min_epoch(netdev_pub_t *pub) {
+  uint64_t min = UINT64_MAX;
+  for (size_t i = 0; i < NETDEV_PUB_READERS; i++) {
+    uint64_t e = atomic_load(&pub->readers[i].epoch);
+    if (e && e < min) min = e;
+  }
+  return min;
+}
+
+static size_t pub_reclaim_locked(netdev_pub_t *pub) {
+  uint64_t min = pub_min_epoch(pub);
+  netdev_snap_t **pp = &pub->retired;
+  size_t left = 0;
+
+  /* a reader that entered in epoch e may hold anything retired in e or later */
+  while (*pp) {
+    netdev_snap_t *snap = *pp;
+    if (snap->retired < min) {
+      *pp = snap->next;
+      snap_free(snap);
+    } else {
+      pp = &snap->next;
+      left++;
+    }
+  }
+  return left;
+}
+
+size_t netdev_pub_reclaim(netdev_pub_t *pub) {
+  pthread_mutex_lock(&pub->lock);
+  size_t left = pub_reclaim_locked(pub);
+  pthread_mutex_unlock(&pub->lock);
+  return left;
+}
+
+int netdev_pub_publish(netdev_pub_t *pub, netdev_table_t *table) {
+  FUNC_START_DEBUG;
+  netdev_snap_t *snap = calloc(1, sizeof(*snap));
+  if (!snap) {
+    syslog2(LOG_ALERT, "Failed to allocate memory for a snapshot.");
+    return -1;
+  }
+  /* the table owns its items by pointer, moving the struct moves them all */
+  snap->table = *table;
+  memset(table, 0, sizeof(*table));
+
+  pthread_mutex_lock(&pub->lock);
+  snap->version = ++pub->version;
+  netdev_snap_t *old = atomic_exchange(&pub->current, snap);
+  if (old) {
+    /* readers entering after the epoch bump only ever see snap */
+    old->retired = atomic_fetch_add(&pub->epoch, 1);
+    old->next = pub->retired;
+    pub->retired = old;
+  }
+  pub_reclaim_locked(pub);
+  pthread_mutex_unlock(&pub->lock);
+  return 0;
+}
+
+int netdev_pub_update(netdev_pub_t *pub, nl_ctx_t *ctx) {
+  FUNC_START_DEBUG;
+  netdev_table_t table;
+
+  /* the dump runs outside the writer lock, readers keep the old snapshot */
+  if (netdev_table_init(&table)) return -1;
+  if (get_netdev_table(ctx, &table)) {
+    int err = errno;
+    netdev_table_free(&table);
+    errno = err;
+    return -1;
+  }
+  if (netdev_pub_publish(pub, &table)) {
+    netdev_table_free(&table);
+    return -1;
+  }
+  return 0;
+}
+
+netdev_reader_t *netdev_pub_reader(netdev_pub_t *pub) {
+  for (size_t i = 0; i < NETDEV_PUB_READERS; i++) {
+    bool expected = false;
+    if (atomic_compare_exchange_strong(&pub->readers[i].used, &expected, true)) return &pub->readers[i];
+  }
+  errno = EAGAIN;
+  return NULL;
+}
+
+void netdev_pub_reader_put(netdev_reader_t *reader) {
+  atomic_store(&reader->epoch, 0);
+  atomic_store(&reader->used, false);
+}
+
+const netdev_snap_t *netdev_snap_acquire(netdev_pub_t *pub, netdev_reader_t *reader) {
+  /* announce the epoch before looking at current, both seq_cst so the writer
+   * either sees this reader or this reader sees the new snapshot */
+  atomic_store(&reader->epoch, atomic_load(&pub->epoch));
+  return atomic_load(&pub->current);
+}
+
+void netdev_snap_release(netdev_reader_t *reader) {
+  atomic_store_explicit(&reader->epoch, 0, memory_order_release);
+}
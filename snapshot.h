@@ -0,0 +1,60 @@
+#ifndef NETLINK_GET_ADDR_SNAPSHOT_H
+#define NETLINK_GET_ADDR_SNAPSHOT_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "libnl_getlink.h"
+
+/* reader slots of one publisher, each reading thread holds one */
+#ifndef NETDEV_PUB_READERS
+#define NETDEV_PUB_READERS 64
+#endif
+
+/* immutable device set, never changed after it was published */
+typedef struct netdev_snap {
+  netdev_table_t table;
+  uint64_t version;          /* 1 for the first snapshot, +1 per publish */
+  uint64_t retired;          /* epoch it was replaced in */
+  struct netdev_snap *next;  /* retired list */
+} netdev_snap_t;
+
+/* per thread epoch, 0 while outside a read section */
+typedef struct netdev_reader {
+  _Alignas(64) atomic_uint_fast64_t epoch;
+  atomic_bool used;
+} netdev_reader_t;
+
+/* single writer, many wait-free readers: the writer swaps in a new snapshot
+ * and frees old ones once no reader can still see them (epoch reclamation) */
+typedef struct netdev_pub {
+  _Atomic(netdev_snap_t *) current;
+  atomic_uint_fast64_t epoch;
+  pthread_mutex_t lock;     /* serializes writers and the retired list */
+  netdev_snap_t *retired;
+  uint64_t version;
+  netdev_reader_t readers[NETDEV_PUB_READERS];
+} netdev_pub_t;
+
+int netdev_pub_init(netdev_pub_t *pub);
+/* frees every snapshot, no reader may be inside a read section */
+void netdev_pub_destroy(netdev_pub_t *pub);
+/* dump with ctx and publish the result */
+int netdev_pub_update(netdev_pub_t *pub, nl_ctx_t *ctx);
+/* publish a table built elsewhere, its contents move into the snapshot and
+ * the table is left empty */
+int netdev_pub_publish(netdev_pub_t *pub, netdev_table_t *table);
+/* free retired snapshots no reader can reach, returns how many are left */
+size_t netdev_pub_reclaim(netdev_pub_t *pub);
+
+/* reader slots: take one per thread once, NULL with EAGAIN when all are taken */
+netdev_reader_t *netdev_pub_reader(netdev_pub_t *pub);
+void netdev_pub_reader_put(netdev_reader_t *reader);
+
+/* read section: the snapshot stays valid until netdev_snap_release(), NULL
+ * if nothing was published yet. Both calls never block or loop. */
+const netdev_snap_t *netdev_snap_acquire(netdev_pub_t *pub, netdev_reader_t *reader);
+void netdev_snap_release(netdev_reader_t *reader);
+
+#endif // NETLINK_GET_ADDR_SNAPSHOT_H
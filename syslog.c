@@ -2,10 +2,15 @@
 #define _GNU_SOURCE
 #endif
 
+#include <errno.h>
+#include <fcntl.h>   // open()
 #include <pthread.h> // pthread_spinlock_t, pthread_spin_lock, pthread_spin_unlock
 #include <stdarg.h>  // va_list, va_start(), va_end()
+#include <stdatomic.h>
+#include <stddef.h>  // ptrdiff_t
 #include <stdio.h>   // printf()
 #include <stdlib.h>
+#include <string.h>
 #include <sys/syscall.h> // SYS_gettid
 #include <sys/time.h>    // gettimeofday()
 #include <syslog.h>      // syslog()
@@ -78,65 +83,644 @@ int clock_gettime_fast(struct timespec *ts, bool coarse) {
   return ret;
 }
 
-static void get_current_time(struct timespec *ts, struct tm *tm_info) {
-  if (!clock_gettime_fast(ts, true)) {
+// gettid() once per thread
+static __thread pid_t cached_tid;
+
+static inline pid_t gettid_cached(void) {
+  if (unlikely(!cached_tid)) cached_tid = syscall(SYS_gettid);
+  return cached_tid;
+}
+
+// formatted time prefix, reused while the millisecond does not change
+typedef struct time_cache {
+  time_t sec;
+  long msec;
+  char buf[64];
+} time_cache_t;
+
+static __thread time_cache_t time_cache = {.sec = -1};
+
+static const char *format_time(const struct timespec *ts) {
+  long msec = ts->tv_nsec / 1000000;
+  if (ts->tv_sec != time_cache.sec || msec != time_cache.msec) {
+    struct tm tm_info;
     time_t current_timestamp = ts->tv_sec + timezone_offset_global;
-    gmtime_r(&current_timestamp, tm_info);
+    gmtime_r(&current_timestamp, &tm_info);
+    snprintf(time_cache.buf, sizeof(time_cache.buf), "%02d-%02d-%02d %02d:%02d:%02d.%03ld",
+             tm_info.tm_mday, tm_info.tm_mon + 1, tm_info.tm_year + 1900,
+             tm_info.tm_hour, tm_info.tm_min, tm_info.tm_sec, msec);
+    time_cache.sec = ts->tv_sec;
+    time_cache.msec = msec;
   }
+  return time_cache.buf;
 }
 
-void syslog2_(int pri, const char *func, const char *filename, int line, const char *fmt, bool add_nl, ...) {
-  if (!(cached_mask & LOG_MASK(pri))) return;
+static void log_output(int pri, pid_t tid, const struct timespec *ts, const char *func, const char *filename, int line,
+                       const char *msg, bool add_nl, bool raw) {
+  const char *nl = add_nl ? "\n" : "";
+  if (likely(log_syslog)) {
+    if (raw) {
+      syslog(pri, "%s", msg);
+    } else {
+      syslog(pri, "[%d] %s:%d: %s: %s%s", tid, filename, line, func, msg, nl);
+    }
+  } else {
+    if (raw) {
+      fputs(msg, stdout);
+    } else {
+      printf("[%s] %s [%d] %s:%d: %s: %s%s", format_time(ts), strprio(pri), tid, filename, line, func, msg, nl);
+    }
+  }
+}
 
-  char msg[32768];
+/* async mode: callers only format the message into a per-thread single
+ * producer ring, the logger thread adds the prefix and writes it out */
+typedef struct log_record {
+  struct timespec ts;
+  const char *func;
+  const char *filename;
+  int line;
+  short pri;
+  bool add_nl;
+  bool raw;
+  char msg[SYSLOG2_ASYNC_MSG];
+} log_record_t;
+
+typedef struct log_ring {
+  _Alignas(64) atomic_uint head; /* written by the owning thread */
+  atomic_bool busy;              /* owner is inside async_push() */
+  _Alignas(64) atomic_uint tail; /* written by the logger thread */
+  atomic_ulong dropped;
+  atomic_bool dead;              /* owner exited, free once drained */
+  pid_t tid;
+  struct log_ring *next;
+  log_record_t slots[SYSLOG2_ASYNC_SLOTS];
+} log_ring_t;
+
+static atomic_bool async_on;
+static atomic_bool async_stop;
+static bool async_running; /* logger thread alive, under rings_lock */
+static pthread_t async_thread;
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static log_ring_t *rings;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+static __thread log_ring_t *tls_ring;
 
+/* the logger frees the ring once drained, with no logger it goes now */
+static void ring_release(void *arg) {
+  log_ring_t *ring = arg;
+
+  pthread_mutex_lock(&rings_lock);
+  if (async_running) {
+    atomic_store(&ring->dead, true);
+  } else {
+    for (log_ring_t **pp = &rings; *pp; pp = &(*pp)->next) {
+      if (*pp == ring) {
+        *pp = ring->next;
+        break;
+      }
+    }
+    free(ring);
+  }
+  pthread_mutex_unlock(&rings_lock);
+}
+
+static void ring_key_init(void) {
+  pthread_key_create(&ring_key, ring_release);
+}
+
+static log_ring_t *ring_get(void) {
+  if (likely(tls_ring != NULL)) return tls_ring;
+
+  log_ring_t *ring = calloc(1, sizeof(*ring));
+  if (!ring) return NULL;
+  ring->tid = gettid_cached();
+  pthread_once(&ring_key_once, ring_key_init);
+  pthread_setspecific(ring_key, ring);
+
+  pthread_mutex_lock(&rings_lock);
+  ring->next = rings;
+  rings = ring;
+  pthread_mutex_unlock(&rings_lock);
+  tls_ring = ring;
+  return ring;
+}
+
+/* claim the next slot, NULL if the logger thread is behind */
+static log_record_t *ring_reserve(log_ring_t *ring) {
+  unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  if (head - tail >= SYSLOG2_ASYNC_SLOTS) {
+    atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+    return NULL;
+  }
+  return &ring->slots[head % SYSLOG2_ASYNC_SLOTS];
+}
+
+static void ring_commit(log_ring_t *ring) {
+  unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+/* false if the thread has no ring or async mode was stopped meanwhile, the
+ * caller writes the message itself. busy is raised before async_on is checked
+ * again so syslog2_async_stop() either sees the producer or the producer sees
+ * the stop */
+static bool async_push(int pri, const char *func, const char *filename, int line, bool add_nl, bool raw,
+                       const char *fmt, va_list args) {
+  log_ring_t *ring = ring_get();
+  if (!ring) return false;
+
+  atomic_store(&ring->busy, true);
+  if (!atomic_load(&async_on)) {
+    atomic_store_explicit(&ring->busy, false, memory_order_release);
+    return false;
+  }
+  log_record_t *rec = ring_reserve(ring);
+  if (!rec) {
+    atomic_store_explicit(&ring->busy, false, memory_order_release);
+    return true;
+  }
+
+  clock_gettime_fast(&rec->ts, true);
+  rec->func = func;
+  rec->filename = filename;
+  rec->line = line;
+  rec->pri = pri;
+  rec->add_nl = add_nl;
+  rec->raw = raw;
+  vsnprintf(rec->msg, sizeof(rec->msg), fmt, args);
+  ring_commit(ring);
+  atomic_store_explicit(&ring->busy, false, memory_order_release);
+  return true;
+}
+
+/* write out everything queued, returns the number of records */
+static size_t async_drain(void) {
+  size_t n = 0;
+
+  pthread_mutex_lock(&rings_lock);
+  for (log_ring_t **pp = &rings; *pp;) {
+    log_ring_t *ring = *pp;
+    bool dead = atomic_load(&ring->dead); /* before reading head, no record is missed */
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+    for (; tail != head; tail++, n++) {
+      log_record_t *rec = &ring->slots[tail % SYSLOG2_ASYNC_SLOTS];
+      log_output(rec->pri, ring->tid, &rec->ts, rec->func, rec->filename, rec->line, rec->msg, rec->add_nl, rec->raw);
+    }
+    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+    unsigned long dropped = atomic_exchange_explicit(&ring->dropped, 0, memory_order_relaxed);
+    if (dropped) {
+      char msg[64];
+      struct timespec ts;
+      clock_gettime_fast(&ts, true);
+      snprintf(msg, sizeof(msg), "%lu log messages dropped, ring full", dropped);
+      log_output(LOG_WARNING, ring->tid, &ts, __func__, __FILENAME__, __LINE__, msg, true, false);
+    }
+
+    if (dead) {
+      *pp = ring->next;
+      free(ring);
+    } else {
+      pp = &ring->next;
+    }
+  }
+  pthread_mutex_unlock(&rings_lock);
+
+  if (n && !log_syslog) fflush(stdout);
+  return n;
+}
+
+static void *async_main(void *arg) {
+  (void)arg;
+  long idle_us = 100;
+
+  /* back off while there is nothing to write, up to SYSLOG2_ASYNC_IDLE_US */
+  while (!atomic_load(&async_stop)) {
+    if (async_drain()) {
+      idle_us = 100;
+      continue;
+    }
+    struct timespec nap = {.tv_sec = 0, .tv_nsec = idle_us * 1000};
+    nanosleep(&nap, NULL);
+    if (idle_us < SYSLOG2_ASYNC_IDLE_US) idle_us *= 2;
+  }
+  async_drain();
+  return NULL;
+}
+
+int syslog2_async_start(void) {
+  if (atomic_load(&async_on)) return 0;
+  if (!syslog_initialized) {
+    initialize_time_cache();
+    syslog_initialized = 1;
+  }
+  atomic_store(&async_stop, false);
+  pthread_mutex_lock(&rings_lock);
+  async_running = true;
+  pthread_mutex_unlock(&rings_lock);
+  if (pthread_create(&async_thread, NULL, async_main, NULL)) {
+    pthread_mutex_lock(&rings_lock);
+    async_running = false;
+    pthread_mutex_unlock(&rings_lock);
+    return -1;
+  }
+  atomic_store(&async_on, true);
+  return 0;
+}
+
+/* true once no producer is inside async_push() and the logger wrote out
+ * every ring */
+static bool async_idle(void) {
+  bool idle = true;
+
+  pthread_mutex_lock(&rings_lock);
+  for (log_ring_t *ring = rings; ring && idle; ring = ring->next) {
+    idle = !atomic_load(&ring->busy) &&
+           atomic_load_explicit(&ring->head, memory_order_acquire) ==
+               atomic_load_explicit(&ring->tail, memory_order_acquire);
+  }
+  pthread_mutex_unlock(&rings_lock);
+  return idle;
+}
+
+void syslog2_async_stop(void) {
+  if (!atomic_exchange(&async_on, false)) return;
+
+  /* producers that passed the async_on check finish their record while the
+   * logger is still running */
+  while (!async_idle()) {
+    struct timespec nap = {.tv_sec = 0, .tv_nsec = 100000};
+    nanosleep(&nap, NULL);
+  }
+  atomic_store(&async_stop, true);
+  pthread_join(async_thread, NULL);
+
+  /* rings of threads that exited since the last drain, later exits free
+   * their own in ring_release() */
+  pthread_mutex_lock(&rings_lock);
+  async_running = false;
+  for (log_ring_t **pp = &rings; *pp;) {
+    log_ring_t *ring = *pp;
+    if (atomic_load(&ring->dead)) {
+      *pp = ring->next;
+      free(ring);
+    } else {
+      pp = &ring->next;
+    }
+  }
+  pthread_mutex_unlock(&rings_lock);
+}
+
+
+static void vsyslog2_(int pri, const char *func, const char *filename, int line, const char *fmt, bool add_nl, va_list args) {
+  if (atomic_load_explicit(&async_on, memory_order_relaxed) &&
+      async_push(pri, func, filename, line, add_nl, false, fmt, args)) {
+    return;
+  }
+
+  char msg[32768];
   struct timespec ts;
-  struct tm tm_info;
-  pid_t tid = syscall(SYS_gettid);
+
+  vsnprintf(msg, sizeof(msg), fmt, args);
+
+  if (!log_syslog) clock_gettime_fast(&ts, true);
+  log_output(pri, gettid_cached(), &ts, func, filename, line, msg, add_nl, false);
+}
+
+void syslog2_(int pri, const char *func, const char *filename, int line, const char *fmt, bool add_nl, ...) {
+  if (!(cached_mask & LOG_MASK(pri))) return;
 
   va_list args;
   va_start(args, add_nl);
-  vsnprintf(msg, sizeof(msg), fmt, args);
+  vsyslog2_(pri, func, filename, line, fmt, add_nl, args);
   va_end(args);
+}
 
-  if (likely(log_syslog)) {
-    if (add_nl) {
-      syslog(pri, "[%d] %s:%d: %s: %s\n", tid, filename, line, func, msg);
+const char *syslog2_fmt_next(const char *p, syslog2_spec_t *spec) {
+  while (*p && *p != '%') p++;
+  if (!*p) return NULL;
+
+  memset(spec, 0, sizeof(*spec));
+  spec->start = p++;
+  spec->prec = -1;
+
+  while (*p && strchr("-+ #0'", *p)) p++;
+  if (*p == '*') {
+    spec->star_width = true;
+    p++;
+  }
+  while (*p >= '0' && *p <= '9') p++;
+  if (*p == '.') {
+    p++;
+    if (*p == '*') {
+      spec->star_prec = true;
+      p++;
     } else {
-      syslog(pri, "[%d] %s:%d: %s: %s", tid, filename, line, func, msg);
+      spec->prec = 0;
+      while (*p >= '0' && *p <= '9') spec->prec = spec->prec * 10 + *p++ - '0';
     }
-  } else {
-    char timebuf[64];
-    get_current_time(&ts, &tm_info);
-    sprintf(timebuf, "%02d-%02d-%02d %02d:%02d:%02d.%03ld",
-            tm_info.tm_mday, tm_info.tm_mon + 1, tm_info.tm_year + 1900,
-            tm_info.tm_hour, tm_info.tm_min, tm_info.tm_sec, ts.tv_nsec / 1000000);
-    if (add_nl) {
-      printf("[%s] %s [%d] %s:%d: %s: %s\n", timebuf, strprio(pri), tid, filename, line, func, msg);
+  }
+
+  int size = SYSLOG2_A_INT;
+  switch (*p) {
+  case 'h':
+    p += p[1] == 'h' ? 2 : 1;
+    break;
+  case 'l':
+    size = p[1] == 'l' ? SYSLOG2_A_LLONG : SYSLOG2_A_LONG;
+    p += p[1] == 'l' ? 2 : 1;
+    break;
+  case 'q':
+    size = SYSLOG2_A_LLONG;
+    p++;
+    break;
+  case 'j':
+    size = SYSLOG2_A_INTMAX;
+    p++;
+    break;
+  case 'z':
+    size = SYSLOG2_A_SIZE;
+    p++;
+    break;
+  case 't':
+    size = SYSLOG2_A_PTRDIFF;
+    p++;
+    break;
+  case 'L':
+    size = SYSLOG2_A_LDOUBLE;
+    p++;
+    break;
+  }
+
+  switch (*p) {
+  case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+    spec->type = size == SYSLOG2_A_LDOUBLE ? SYSLOG2_A_LLONG : size;
+    break;
+  case 'c':
+    spec->type = size == SYSLOG2_A_LONG ? SYSLOG2_A_BAD : SYSLOG2_A_INT; // wint_t
+    break;
+  case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+    spec->type = size == SYSLOG2_A_LDOUBLE ? SYSLOG2_A_LDOUBLE : SYSLOG2_A_DOUBLE;
+    break;
+  case 's':
+    spec->type = size == SYSLOG2_A_LONG ? SYSLOG2_A_BAD : SYSLOG2_A_STR;
+    break;
+  case 'p':
+    spec->type = SYSLOG2_A_PTR;
+    break;
+  case '%':
+    spec->type = SYSLOG2_A_NONE;
+    break;
+  default:
+    spec->type = SYSLOG2_A_BAD;
+    if (!*p) p--;
+    break;
+  }
+  spec->len = p + 1 - spec->start;
+  return p + 1;
+}
+
+/* binary mode: one buffer shared by all threads, written out when full */
+static atomic_bool binary_on;
+static pthread_mutex_t binary_lock = PTHREAD_MUTEX_INITIALIZER;
+static int binary_fd = -1;
+static unsigned int binary_sites;
+static unsigned int binary_gen; /* ids of older logs do not count */
+static size_t binary_len;
+static uint8_t binary_buf[SYSLOG2_BINARY_BUF];
+
+static void binary_flush_locked(void) {
+  size_t off = 0;
+  while (off < binary_len) {
+    ssize_t n = write(binary_fd, binary_buf + off, binary_len - off);
+    if (n <= 0) break; /* nowhere to report it, the log is the broken part */
+    off += n;
+  }
+  binary_len = 0;
+}
+
+static void binary_put(const void *data, size_t len) {
+  const uint8_t *p = data;
+  while (len) {
+    if (binary_len == sizeof(binary_buf)) binary_flush_locked();
+    size_t n = sizeof(binary_buf) - binary_len;
+    if (n > len) n = len;
+    memcpy(binary_buf + binary_len, p, n);
+    binary_len += n;
+    p += n;
+    len -= n;
+  }
+}
+
+/* fill in the argument list of a site, text if the format is beyond us */
+static void site_parse(syslog2_site_t *site) {
+  syslog2_spec_t spec;
+  const char *p = site->fmt;
+  unsigned int n = 0;
+
+  while ((p = syslog2_fmt_next(p, &spec))) {
+    if (spec.type == SYSLOG2_A_NONE) continue;
+    if (spec.type == SYSLOG2_A_BAD || n + spec.star_width + spec.star_prec + 1 > SYSLOG2_SITE_ARGS) {
+      site->text = true;
+      return;
+    }
+    if (spec.star_width) site->args[n++] = SYSLOG2_A_INT;
+    if (spec.star_prec) site->args[n++] = SYSLOG2_A_INT;
+    site->prec[n] = spec.star_prec ? SYSLOG2_PREC_STAR : spec.prec;
+    site->args[n++] = spec.type;
+  }
+  site->nargs = n;
+}
+
+static void binary_site(syslog2_site_t *site) {
+  if (!site->nargs && !site->text) site_parse(site);
+  unsigned int id = binary_gen << SYSLOG2_SITE_BITS | ++binary_sites;
+  int32_t line = site->line;
+  uint8_t pri = site->pri;
+  const char *fmt = site->text ? "%s" : site->fmt;
+  syslog2_bin_rec_t rec = {.type = SYSLOG2_BIN_SITE};
+  rec.len = sizeof(rec) + sizeof(id) + sizeof(line) + sizeof(pri) + strlen(fmt) + 1 + strlen(site->file) + 1 + strlen(site->func) + 1;
+
+  binary_put(&rec, sizeof(rec));
+  binary_put(&id, sizeof(id));
+  binary_put(&line, sizeof(line));
+  binary_put(&pri, sizeof(pri));
+  binary_put(fmt, strlen(fmt) + 1);
+  binary_put(site->file, strlen(site->file) + 1);
+  binary_put(site->func, strlen(site->func) + 1);
+  atomic_store(&site->id, id);
+}
+
+/* walk the arguments, writing them if put is set, returns their size */
+static size_t binary_args(const syslog2_site_t *site, va_list args, bool put) {
+  size_t size = 0;
+  int64_t prev_int = -1;
+
+  for (unsigned int i = 0; i < site->nargs; i++) {
+    int64_t v = 0;
+    double d = 0;
+    const char *str;
+    switch (site->args[i]) {
+    case SYSLOG2_A_INT: v = va_arg(args, int); prev_int = v; break;
+    case SYSLOG2_A_LONG: v = va_arg(args, long); break;
+    case SYSLOG2_A_LLONG: v = va_arg(args, long long); break;
+    case SYSLOG2_A_SIZE: v = va_arg(args, size_t); break;
+    case SYSLOG2_A_INTMAX: v = va_arg(args, intmax_t); break;
+    case SYSLOG2_A_PTRDIFF: v = va_arg(args, ptrdiff_t); break;
+    case SYSLOG2_A_PTR: v = (intptr_t)va_arg(args, void *); break;
+    case SYSLOG2_A_DOUBLE: d = va_arg(args, double); break;
+    case SYSLOG2_A_LDOUBLE: d = va_arg(args, long double); break;
+    case SYSLOG2_A_STR: {
+      str = va_arg(args, const char *);
+      uint32_t len = SYSLOG2_BIN_NULL;
+      /* %.Ns and %.*s may point to unterminated bytes */
+      int prec = site->prec[i] == SYSLOG2_PREC_STAR ? (int)prev_int : site->prec[i];
+      if (str) len = prec >= 0 ? strnlen(str, prec) : strlen(str);
+      size += sizeof(len) + (len == SYSLOG2_BIN_NULL ? 0 : len);
+      if (put) {
+        binary_put(&len, sizeof(len));
+        if (len != SYSLOG2_BIN_NULL) binary_put(str, len);
+      }
+      continue;
+    }
+    }
+    size += 8;
+    if (!put) continue;
+    if (site->args[i] == SYSLOG2_A_DOUBLE || site->args[i] == SYSLOG2_A_LDOUBLE) {
+      binary_put(&d, sizeof(d));
     } else {
-      printf("[%s] %s [%d] %s:%d: %s: %s", timebuf, strprio(pri), tid, filename, line, func, msg);
+      binary_put(&v, sizeof(v));
     }
   }
+  return size;
+}
+
+static void binary_log(syslog2_site_t *site, bool add_nl, va_list args) {
+  struct timespec ts;
+  clock_gettime_fast(&ts, false);
+  uint64_t ns = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+  uint32_t tid = gettid_cached();
+  uint8_t nl = add_nl;
+
+  pthread_mutex_lock(&binary_lock);
+  if (binary_fd < 0) {
+    pthread_mutex_unlock(&binary_lock);
+    return;
+  }
+  if (atomic_load(&site->id) >> SYSLOG2_SITE_BITS != binary_gen) binary_site(site);
+  uint32_t id = atomic_load(&site->id);
+
+  char text[SYSLOG2_ASYNC_MSG];
+  va_list copy;
+  va_copy(copy, args);
+  size_t size;
+  if (site->text) {
+    vsnprintf(text, sizeof(text), site->fmt, copy);
+    size = sizeof(uint32_t) + strlen(text);
+  } else {
+    size = binary_args(site, copy, false);
+  }
+  va_end(copy);
+
+  syslog2_bin_rec_t rec = {.type = SYSLOG2_BIN_MSG};
+  rec.len = sizeof(rec) + sizeof(id) + sizeof(tid) + sizeof(ns) + sizeof(nl) + size;
+  binary_put(&rec, sizeof(rec));
+  binary_put(&id, sizeof(id));
+  binary_put(&tid, sizeof(tid));
+  binary_put(&ns, sizeof(ns));
+  binary_put(&nl, sizeof(nl));
+  if (site->text) {
+    uint32_t len = strlen(text);
+    binary_put(&len, sizeof(len));
+    binary_put(text, len);
+  } else {
+    binary_args(site, args, true);
+  }
+  pthread_mutex_unlock(&binary_lock);
+}
+
+int syslog2_binary_start(const char *path) {
+  syslog2_bin_file_t fh = {.magic = SYSLOG2_BIN_MAGIC, .version = SYSLOG2_BIN_VERSION};
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) return -1;
+
+  if (!syslog_initialized) {
+    initialize_time_cache();
+    syslog_initialized = 1;
+  }
+  fh.tz_offset = timezone_offset_global;
+  if (write(fd, &fh, sizeof(fh)) != sizeof(fh)) {
+    close(fd);
+    return -1;
+  }
+
+  pthread_mutex_lock(&binary_lock);
+  if (binary_fd >= 0) {
+    pthread_mutex_unlock(&binary_lock);
+    close(fd);
+    errno = EBUSY;
+    return -1;
+  }
+  binary_fd = fd;
+  binary_gen++;
+  binary_sites = 0;
+  pthread_mutex_unlock(&binary_lock);
+  atomic_store(&binary_on, true);
+  return 0;
+}
+
+void syslog2_binary_stop(void) {
+  if (!atomic_exchange(&binary_on, false)) return;
+  pthread_mutex_lock(&binary_lock);
+  binary_flush_locked();
+  close(binary_fd);
+  binary_fd = -1;
+  pthread_mutex_unlock(&binary_lock);
+}
+
+void syslog2_flush(void) {
+  if (atomic_load(&async_on)) async_drain();
+  if (atomic_load(&binary_on)) {
+    pthread_mutex_lock(&binary_lock);
+    if (binary_fd >= 0) binary_flush_locked();
+    pthread_mutex_unlock(&binary_lock);
+  }
+  fflush(stdout);
+}
+
+void syslog2_site_(syslog2_site_t *site, bool add_nl, ...) {
+  va_list args;
+  va_start(args, add_nl);
+  if (atomic_load_explicit(&binary_on, memory_order_relaxed)) {
+    binary_log(site, add_nl, args);
+  } else {
+    vsyslog2_(site->pri, site->func, site->file, site->line, site->fmt, add_nl, args);
+  }
+  va_end(args);
 }
 
 void syslog2_printf_(int pri, const char *func, const char *filename, int line, const char *fmt, ...) {
-  (void)filename;
-  (void)func;
-  (void)line;
   if (!(cached_mask & LOG_MASK(pri))) return;
 
-  char msg[32768];
-
   va_list args;
   va_start(args, fmt);
+  if (atomic_load_explicit(&async_on, memory_order_relaxed) &&
+      async_push(pri, func, filename, line, false, true, fmt, args)) {
+    va_end(args);
+    return;
+  }
+
+  char msg[32768];
+
   vsnprintf(msg, sizeof(msg), fmt, args);
   va_end(args);
 
-  if (likely(log_syslog)) {
-    syslog(pri, "%s", msg);
-  } else {
-    printf("%s", msg);
-  }
+  log_output(pri, 0, NULL, func, filename, line, msg, false, true);
 }
 
 void debug(const char *fmt, ...) {
@@ -6,7 +6,9 @@
 #endif
 
 #include <stdarg.h>      // va_list, va_start(), va_end()
+#include <stdatomic.h>
 #include <stdbool.h>     //bool type
+#include <stdint.h>
 #include <stdio.h>       // printf()
 #include <sys/syscall.h> // SYS_gettid
 #include <syslog.h>      // syslog()
@@ -30,34 +32,149 @@ extern int cached_mask;
 #define DBG printf(__FILE__ ":%d %s\n", __LINE__, __func__)
 #endif
 
+// least important level compiled in, call sites below it are removed,
+// e.g. -DSYSLOG2_MIN_LEVEL=LOG_NOTICE for release builds
+#ifndef SYSLOG2_MIN_LEVEL
+#define SYSLOG2_MIN_LEVEL LOG_DEBUG
+#endif
+
 #ifndef FUNC_START_DEBUG
-#define FUNC_START_DEBUG                      \
-  do {                                        \
-    if ((cached_mask & LOG_MASK(LOG_INFO))) { \
-      syslog2(LOG_INFO, "");                  \
-    }                                         \
+#define FUNC_START_DEBUG                                                          \
+  do {                                                                            \
+    if (LOG_INFO <= SYSLOG2_MIN_LEVEL && (cached_mask & LOG_MASK(LOG_INFO))) { \
+      syslog2(LOG_INFO, "");                                                      \
+    }                                                                             \
   } while (0)
 #endif
 
+// arguments a call site can record in binary mode, more are logged as text
+#define SYSLOG2_SITE_ARGS 16
+#define SYSLOG2_SITE_BITS 20 // low bits of a site id, the rest is the log generation
+#define SYSLOG2_PREC_STAR -2
+
+// binary mode buffer, written to the file when full
+#ifndef SYSLOG2_BINARY_BUF
+#define SYSLOG2_BINARY_BUF 65536
+#endif
+
+// argument kinds recorded by the binary mode
+enum {
+  SYSLOG2_A_NONE, // %%
+  SYSLOG2_A_INT,
+  SYSLOG2_A_LONG,
+  SYSLOG2_A_LLONG,
+  SYSLOG2_A_SIZE,
+  SYSLOG2_A_INTMAX,
+  SYSLOG2_A_PTRDIFF,
+  SYSLOG2_A_DOUBLE,
+  SYSLOG2_A_LDOUBLE,
+  SYSLOG2_A_STR,
+  SYSLOG2_A_PTR,
+  SYSLOG2_A_BAD, // %n, wide strings and other unsupported conversions
+};
+
+// one printf conversion
+typedef struct syslog2_spec {
+  const char *start; // the '%'
+  size_t len;        // up to and including the conversion character
+  bool star_width;   // takes an int width argument first
+  bool star_prec;    // then an int precision argument
+  int prec;          // literal precision or -1
+  int type;          // SYSLOG2_A_*
+} syslog2_spec_t;
+
+// binary log file: syslog2_bin_file_t, then records starting with
+// syslog2_bin_rec_t. A site record (id, line, pri, fmt, file and func as
+// C strings) comes before the first message of that site. A message record
+// holds id, tid, ns timestamp, newline flag and the arguments: integers and
+// doubles as 8 bytes, strings as a 4 byte length and the bytes.
+#define SYSLOG2_BIN_MAGIC 0x4c423253u // "S2BL"
+#define SYSLOG2_BIN_VERSION 1
+#define SYSLOG2_BIN_SITE 1
+#define SYSLOG2_BIN_MSG 2
+#define SYSLOG2_BIN_NULL 0xffffffffu // string length of a NULL pointer
+
+typedef struct syslog2_bin_file {
+  uint32_t magic;
+  uint32_t version;
+  int64_t tz_offset; // seconds east of UTC where the log was written
+} syslog2_bin_file_t;
+
+typedef struct syslog2_bin_rec {
+  uint16_t type;
+  uint16_t reserved;
+  uint32_t len; // including this header
+} syslog2_bin_rec_t;
+
+// static description of one syslog2() call, the binary log refers to it by id
+typedef struct syslog2_site {
+  const char *fmt;
+  const char *file;
+  const char *func;
+  int line;
+  int pri;
+  atomic_uint id;                          // log generation and number, 0 until first binary use
+  unsigned char nargs;                     // filled together with id
+  unsigned char args[SYSLOG2_SITE_ARGS];   // SYSLOG2_A_*
+  short prec[SYSLOG2_SITE_ARGS];           // string precision, -1 or SYSLOG2_PREC_STAR
+  bool text;                               // fmt could not be parsed
+} syslog2_site_t;
+
+// async mode: records per thread ring, message bytes per record and the
+// longest the logger thread sleeps when there is nothing to write
+#ifndef SYSLOG2_ASYNC_SLOTS
+#define SYSLOG2_ASYNC_SLOTS 512
+#endif
+#ifndef SYSLOG2_ASYNC_MSG
+#define SYSLOG2_ASYNC_MSG 256
+#endif
+#ifndef SYSLOG2_ASYNC_IDLE_US
+#define SYSLOG2_ASYNC_IDLE_US 20000
+#endif
+
 int setlogmask2(int log_level);
 void setup_syslog2(int log_level, bool set_log_syslog);
 void syslog2_(int pri, const char *func, const char *filename, int line, const char *fmt, bool add_nl, ...);
 void syslog2_printf_(int pri, const char *func, const char *filename, int line, const char *fmt, ...);
+void syslog2_site_(syslog2_site_t *site, bool add_nl, ...);
+// next conversion at or after p, returns the character after it or NULL
+const char *syslog2_fmt_next(const char *p, syslog2_spec_t *spec);
 int clock_gettime_fast(struct timespec *ts, bool coarse);
+// hand formatting and output to a logger thread, messages longer than
+// SYSLOG2_ASYNC_MSG are cut and a full ring drops instead of blocking
+int syslog2_async_start(void);
+void syslog2_async_stop(void);
+void syslog2_flush(void);
+// binary mode: call sites append their id and raw arguments to a buffer
+// written to path, syslog2_decode renders it as text
+int syslog2_binary_start(const char *path);
+void syslog2_binary_stop(void);
 void debug(const char *fmt, ...);
 
 #define __FILENAME__ (__builtin_strrchr(__FILE__, '/') ? __builtin_strrchr(__FILE__, '/') + 1 : __FILE__)
 
+#define syslog2_site_call_(pri_, add_nl_, fmt_, ...)                                             \
+  do {                                                                                         \
+    if ((pri_) <= SYSLOG2_MIN_LEVEL && (cached_mask & LOG_MASK(pri_))) {                       \
+      static syslog2_site_t syslog2_site = {                                                   \
+          .fmt = fmt_, .file = __FILENAME__, .func = __func__, .line = __LINE__, .pri = pri_}; \
+      syslog2_site_(&syslog2_site, add_nl_, ##__VA_ARGS__);                                    \
+    }                                                                                          \
+  } while (0)
+
 #ifndef syslog2
-#define syslog2(pri, fmt, ...) syslog2_(pri, __func__, __FILENAME__, __LINE__, fmt, true, ##__VA_ARGS__)
+#define syslog2(pri, fmt, ...) syslog2_site_call_(pri, true, fmt, ##__VA_ARGS__)
 #endif // syslog2
 
 #ifndef syslog2_nonl
-#define syslog2_nonl(pri, fmt, ...) syslog2_(pri, __func__, __FILENAME__, __LINE__, fmt, false, ##__VA_ARGS__)
+#define syslog2_nonl(pri, fmt, ...) syslog2_site_call_(pri, false, fmt, ##__VA_ARGS__)
 #endif // syslog2
 
 #ifndef syslog2_printf
-#define syslog2_printf(pri, fmt, ...) syslog2_printf_(pri, __func__, __FILENAME__, __LINE__, fmt, ##__VA_ARGS__)
+#define syslog2_printf(pri, fmt, ...)                                                  \
+  do {                                                                                 \
+    if ((pri) <= SYSLOG2_MIN_LEVEL) syslog2_printf_(pri, __func__, __FILENAME__, __LINE__, fmt, ##__VA_ARGS__); \
+  } while (0)
 #endif // syslog2_printf
 
 #endif /* SYSLOG2_H_ */
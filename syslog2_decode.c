@@ -0,0 +1,264 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "syslog.h"
+
+/* renders a binary syslog2 log (syslog2_binary_start()) as the text the
+ * same calls would have printed */
+
+typedef struct site {
+  char *fmt;
+  char *file;
+  char *func;
+  int line;
+  int pri;
+} site_t;
+
+static const char *prio = "MACEWNID";
+
+/* fixed parts: site id, line, pri; message id, tid, ns, newline flag */
+#define SITE_HDR 9
+#define MSG_HDR 17
+
+static site_t *sites;
+static size_t nsites;
+
+static int read_exact(FILE *f, void *buf, size_t len) {
+  return fread(buf, 1, len, f) == len ? 0 : -1;
+}
+
+/* copy of the C string at *p, NULL unless its NUL is before end */
+static char *rec_str(const char **p, const char *end) {
+  const char *nul = memchr(*p, '\0', end - *p);
+  if (!nul) return NULL;
+  char *str = strdup(*p);
+  *p = nul + 1;
+  return str;
+}
+
+static void site_free(site_t *s) {
+  free(s->fmt);
+  free(s->file);
+  free(s->func);
+  memset(s, 0, sizeof(*s));
+}
+
+/* printf one conversion with the star arguments folded into the spec */
+static void put_conv(FILE *out, const syslog2_spec_t *spec, const int *stars, int nstars, const uint8_t *val, uint32_t slen) {
+  char fmt[64];
+  size_t n = 0;
+  int s = 0;
+
+  for (size_t i = 0; i < spec->len && n < sizeof(fmt) - 16; i++) {
+    if (spec->start[i] == '*' && s < nstars) {
+      n += snprintf(fmt + n, sizeof(fmt) - n, "%d", stars[s++]);
+    } else {
+      fmt[n++] = spec->start[i];
+    }
+  }
+  fmt[n] = '\0';
+
+  int64_t v;
+  double d;
+  switch (spec->type) {
+  case SYSLOG2_A_STR: {
+    if (slen == SYSLOG2_BIN_NULL) {
+      fprintf(out, fmt, "(null)");
+      break;
+    }
+    char *str = strndup((const char *)val, slen);
+    fprintf(out, fmt, str);
+    free(str);
+    break;
+  }
+  case SYSLOG2_A_DOUBLE:
+    memcpy(&d, val, sizeof(d));
+    fprintf(out, fmt, d);
+    break;
+  case SYSLOG2_A_LDOUBLE:
+    memcpy(&d, val, sizeof(d));
+    fprintf(out, fmt, (long double)d);
+    break;
+  case SYSLOG2_A_PTR:
+    memcpy(&v, val, sizeof(v));
+    fprintf(out, fmt, (void *)(intptr_t)v);
+    break;
+  case SYSLOG2_A_INT:
+    memcpy(&v, val, sizeof(v));
+    fprintf(out, fmt, (int)v);
+    break;
+  case SYSLOG2_A_LONG:
+    memcpy(&v, val, sizeof(v));
+    fprintf(out, fmt, (long)v);
+    break;
+  case SYSLOG2_A_SIZE:
+    memcpy(&v, val, sizeof(v));
+    fprintf(out, fmt, (size_t)v);
+    break;
+  default:
+    memcpy(&v, val, sizeof(v));
+    fprintf(out, fmt, (long long)v);
+    break;
+  }
+}
+
+static int put_msg(FILE *out, const site_t *site, const uint8_t *p, const uint8_t *end) {
+  const char *fmt = site->fmt;
+  const char *next;
+  syslog2_spec_t spec;
+
+  while ((next = syslog2_fmt_next(fmt, &spec))) {
+    fwrite(fmt, 1, spec.start - fmt, out);
+    fmt = next;
+    if (spec.type == SYSLOG2_A_NONE) {
+      fputc('%', out);
+      continue;
+    }
+
+    int stars[2], nstars = 0;
+    for (int i = 0; i < spec.star_width + spec.star_prec; i++) {
+      int64_t v;
+      if (p + 8 > end) return -1;
+      memcpy(&v, p, 8);
+      p += 8;
+      stars[nstars++] = v;
+    }
+
+    uint32_t slen = 0;
+    if (spec.type == SYSLOG2_A_STR) {
+      if (p + 4 > end) return -1;
+      memcpy(&slen, p, 4);
+      p += 4;
+      if (slen != SYSLOG2_BIN_NULL && p + slen > end) return -1;
+      put_conv(out, &spec, stars, nstars, p, slen);
+      if (slen != SYSLOG2_BIN_NULL) p += slen;
+    } else {
+      if (p + 8 > end) return -1;
+      put_conv(out, &spec, stars, nstars, p, 0);
+      p += 8;
+    }
+  }
+  fputs(fmt, out);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  syslog2_bin_file_t fh;
+  syslog2_bin_rec_t rec;
+  int64_t tz;
+
+  if (argc < 2) {
+    fprintf(stdout, "Usage: %s LOG\n", argv[0]);
+    return -1;
+  }
+  FILE *f = fopen(argv[1], "rb");
+  if (!f) {
+    perror(argv[1]);
+    return -1;
+  }
+  if (read_exact(f, &fh, sizeof(fh)) || fh.magic != SYSLOG2_BIN_MAGIC || fh.version != SYSLOG2_BIN_VERSION) {
+    fprintf(stderr, "%s is not a version %d syslog2 binary log\n", argv[1], SYSLOG2_BIN_VERSION);
+    return -1;
+  }
+  tz = fh.tz_offset;
+
+  uint8_t *buf = NULL;
+  size_t bufsize = 0;
+  size_t bad = 0;
+  int ret = 0;
+  while (!read_exact(f, &rec, sizeof(rec))) {
+    if (rec.len < sizeof(rec)) {
+      fprintf(stderr, "record length %u is shorter than its header, stopping\n", (unsigned int)rec.len);
+      ret = -1;
+      break;
+    }
+    size_t len = rec.len - sizeof(rec);
+    if (len + 1 > bufsize) {
+      uint8_t *tmp = realloc(buf, len + 1);
+      if (!tmp) {
+        fprintf(stderr, "no memory for a record of %zu bytes\n", len);
+        ret = -1;
+        break;
+      }
+      buf = tmp;
+      bufsize = len + 1;
+    }
+    if (read_exact(f, buf, len)) break;
+    buf[len] = '\0';
+
+    if (rec.type != SYSLOG2_BIN_SITE && rec.type != SYSLOG2_BIN_MSG) continue;
+    if (len < (rec.type == SYSLOG2_BIN_SITE ? SITE_HDR : MSG_HDR)) {
+      bad++;
+      continue;
+    }
+
+    uint32_t id;
+    memcpy(&id, buf, sizeof(id));
+    id &= (1u << SYSLOG2_SITE_BITS) - 1;
+
+    if (rec.type == SYSLOG2_BIN_SITE) {
+      site_t site = {0};
+      int32_t line;
+      memcpy(&line, buf + 4, sizeof(line));
+      site.line = line;
+      site.pri = buf[8];
+      const char *str = (const char *)buf + SITE_HDR;
+      const char *end = (const char *)buf + len;
+      if (!(site.fmt = rec_str(&str, end)) || !(site.file = rec_str(&str, end)) || !(site.func = rec_str(&str, end))) {
+        site_free(&site);
+        bad++;
+        continue;
+      }
+      if (id >= nsites) {
+        site_t *tmp = realloc(sites, (id + 1) * sizeof(*sites));
+        if (!tmp) {
+          fprintf(stderr, "no memory for %u sites\n", id + 1);
+          site_free(&site);
+          ret = -1;
+          break;
+        }
+        sites = tmp;
+        memset(sites + nsites, 0, (id + 1 - nsites) * sizeof(*sites));
+        nsites = id + 1;
+      }
+      site_free(&sites[id]);
+      sites[id] = site;
+      continue;
+    }
+    if (id >= nsites || !sites[id].fmt) {
+      fprintf(stderr, "message of unknown site %u\n", id);
+      continue;
+    }
+
+    site_t *s = &sites[id];
+    uint32_t tid;
+    uint64_t ns;
+    memcpy(&tid, buf + 4, sizeof(tid));
+    memcpy(&ns, buf + 8, sizeof(ns));
+    bool nl = buf[MSG_HDR - 1];
+
+    struct tm tm_info;
+    time_t sec = ns / 1000000000ull + tz;
+    gmtime_r(&sec, &tm_info);
+    printf("[%02d-%02d-%02d %02d:%02d:%02d.%03ld] %c [%u] %s:%d: %s: ",
+           tm_info.tm_mday, tm_info.tm_mon + 1, tm_info.tm_year + 1900,
+           tm_info.tm_hour, tm_info.tm_min, tm_info.tm_sec, (long)(ns % 1000000000ull / 1000000),
+           s->pri >= 0 && s->pri <= 7 ? prio[s->pri] : '?', tid, s->file, s->line, s->func);
+    if (put_msg(stdout, s, buf + MSG_HDR, buf + len)) printf("<truncated record>");
+    if (nl) putchar('\n');
+  }
+
+  if (bad) {
+    fprintf(stderr, "%zu corrupt records skipped\n", bad);
+    ret = -1;
+  }
+
+  for (size_t i = 0; i < nsites; i++) site_free(&sites[i]);
+  free(sites);
+  free(buf);
+  fclose(f);
+  return ret;
+}
@@ -0,0 +1,216 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libnl_getlink.h"
+#include "syslog.h"
+#include "topo.h"
+
+#include "leak_detector_c.h"
+
+#define TOPO_NONE UINT32_MAX
+
+static size_t topo_slot(const netdev_topo_t *topo, int index) {
+  return ((uint32_t)index * 2654435761u) & topo->mask;
+}
+
+static uint32_t topo_id(const netdev_topo_t *topo, int index) {
+  if (!topo->keys || index <= 0) return TOPO_NONE;
+  for (size_t i = topo_slot(topo, index);; i = (i + 1) & topo->mask) {
+    if (topo->keys[i] == index) return topo->ids[i];
+    if (!topo->keys[i]) return TOPO_NONE;
+  }
+}
+
+/* group children by parent id: count, prefix sum, fill in dump order */
+static int topo_csr(netdev_topo_t *topo, netdev_item_t **parent, uint32_t **off_out, netdev_item_t ***edges_out) {
+  size_t n = topo->count;
+  uint32_t *off = calloc(n + 1, sizeof(*off));
+  uint32_t *pos = calloc(n + 1, sizeof(*pos));
+  if (!off || !pos) goto fail;
+
+  for (size_t i = 0; i < n; i++) {
+    if (parent[i]) off[topo_id(topo, parent[i]->index) + 1]++;
+  }
+  for (size_t i = 0; i < n; i++) {
+    off[i + 1] += off[i];
+  }
+
+  netdev_item_t **edges = malloc((off[n] ? off[n] : 1) * sizeof(*edges));
+  if (!edges) goto fail;
+  memcpy(pos, off, (n + 1) * sizeof(*pos));
+  for (size_t i = 0; i < n; i++) {
+    if (parent[i]) edges[pos[topo_id(topo, parent[i]->index)]++] = topo->devs[i];
+  }
+  free(pos);
+  *off_out = off;
+  *edges_out = edges;
+  return 0;
+
+fail:
+  free(off);
+  free(pos);
+  return -1;
+}
+
+int netdev_topo_build(netdev_topo_t *topo, netdev_table_t *table) {
+  FUNC_START_DEBUG;
+  size_t n = table->count;
+  netdev_item_t *item;
+
+  memset(topo, 0, sizeof(*topo));
+  topo->count = n;
+  topo->mask = 15;
+  while (topo->mask + 1 < 2 * n) topo->mask = 2 * topo->mask + 1;
+
+  topo->devs = malloc((n ? n : 1) * sizeof(*topo->devs));
+  topo->master = calloc(n ? n : 1, sizeof(*topo->master));
+  topo->lower = calloc(n ? n : 1, sizeof(*topo->lower));
+  topo->marks = calloc(n ? n : 1, sizeof(*topo->marks));
+  topo->keys = calloc(topo->mask + 1, sizeof(*topo->keys));
+  topo->ids = malloc((topo->mask + 1) * sizeof(*topo->ids));
+  if (!topo->devs || !topo->master || !topo->lower || !topo->marks || !topo->keys || !topo->ids) goto fail;
+
+  size_t id = 0;
+  slist_for_each_entry(item, &table->list, list) {
+    size_t i = topo_slot(topo, item->index);
+    while (topo->keys[i] && topo->keys[i] != item->index) i = (i + 1) & topo->mask;
+    topo->keys[i] = item->index;
+    topo->ids[i] = id;
+    topo->devs[id++] = item;
+  }
+
+  /* parents outside the table (other namespace, filtered type) stay NULL */
+  for (size_t i = 0; i < n; i++) {
+    item = topo->devs[i];
+    uint32_t m = topo_id(topo, item->master_idx);
+    uint32_t l = topo_id(topo, item->ifla_link_idx);
+    if (m != TOPO_NONE) topo->master[i] = topo->devs[m];
+    if (l != TOPO_NONE && l != i) topo->lower[i] = topo->devs[l];
+  }
+
+  if (topo_csr(topo, topo->master, &topo->port_off, &topo->ports)) goto fail;
+  if (topo_csr(topo, topo->lower, &topo->link_off, &topo->links)) goto fail;
+  return 0;
+
+fail:
+  syslog2(LOG_ALERT, "Failed to allocate memory for the topology of %zu devices.", n);
+  netdev_topo_free(topo);
+  errno = ENOMEM;
+  return -1;
+}
+
+void netdev_topo_free(netdev_topo_t *topo) {
+  FUNC_START_DEBUG;
+  free(topo->devs);
+  free(topo->master);
+  free(topo->lower);
+  free(topo->port_off);
+  free(topo->ports);
+  free(topo->link_off);
+  free(topo->links);
+  free(topo->keys);
+  free(topo->ids);
+  free(topo->marks);
+  memset(topo, 0, sizeof(*topo));
+}
+
+netdev_item_t *netdev_topo_get(const netdev_topo_t *topo, int index) {
+  uint32_t id = topo_id(topo, index);
+  return id == TOPO_NONE ? NULL : topo->devs[id];
+}
+
+netdev_item_t *netdev_topo_master(const netdev_topo_t *topo, int index) {
+  uint32_t id = topo_id(topo, index);
+  return id == TOPO_NONE ? NULL : topo->master[id];
+}
+
+netdev_item_t *netdev_topo_lower(const netdev_topo_t *topo, int index) {
+  uint32_t id = topo_id(topo, index);
+  return id == TOPO_NONE ? NULL : topo->lower[id];
+}
+
+netdev_item_t *const *netdev_topo_ports(const netdev_topo_t *topo, int master, size_t *n) {
+  uint32_t id = topo_id(topo, master);
+  if (id == TOPO_NONE) {
+    *n = 0;
+    return NULL;
+  }
+  *n = topo->port_off[id + 1] - topo->port_off[id];
+  return &topo->ports[topo->port_off[id]];
+}
+
+netdev_item_t *const *netdev_topo_links(const netdev_topo_t *topo, int index, size_t *n) {
+  uint32_t id = topo_id(topo, index);
+  if (id == TOPO_NONE) {
+    *n = 0;
+    return NULL;
+  }
+  *n = topo->link_off[id + 1] - topo->link_off[id];
+  return &topo->links[topo->link_off[id]];
+}
+
+typedef struct topo_frame {
+  uint32_t id;
+  unsigned int depth;
+} topo_frame_t;
+
+/* push an unvisited device, the stack only grows with the walk result */
+static int topo_push(netdev_topo_t *topo, topo_frame_t **stack, size_t *len, size_t *cap, netdev_item_t *dev, unsigned int depth) {
+  if (!dev) return 0;
+  uint32_t id = topo_id(topo, dev->index);
+  if (topo->marks[id] == topo->epoch) return 0;
+  topo->marks[id] = topo->epoch;
+
+  if (*len == *cap) {
+    size_t size = *cap ? 2 * *cap : 16;
+    topo_frame_t *tmp = realloc(*stack, size * sizeof(*tmp));
+    if (!tmp) return -1;
+    *stack = tmp;
+    *cap = size;
+  }
+  (*stack)[(*len)++] = (topo_frame_t){id, depth};
+  return 0;
+}
+
+int netdev_topo_walk(netdev_topo_t *topo, int index, netdev_topo_dir_t dir, netdev_topo_cb cb, void *arg) {
+  FUNC_START_DEBUG;
+  topo_frame_t *stack = NULL;
+  size_t len = 0, cap = 0;
+  int ret = 0;
+
+  netdev_item_t *start = netdev_topo_get(topo, index);
+  if (!start) {
+    errno = ENODEV;
+    return -1;
+  }
+
+  /* a new stamp marks all devices unvisited without touching them */
+  if (++topo->epoch == 0) {
+    memset(topo->marks, 0, topo->count * sizeof(*topo->marks));
+    topo->epoch = 1;
+  }
+
+  if (topo_push(topo, &stack, &len, &cap, start, 0)) goto nomem;
+  while (len) {
+    topo_frame_t f = stack[--len];
+    ret = cb(topo->devs[f.id], f.depth, arg);
+    if (ret) break;
+
+    netdev_item_t *one = dir == NETDEV_TOPO_UPPER ? topo->master[f.id] : topo->lower[f.id];
+    uint32_t *off = dir == NETDEV_TOPO_UPPER ? topo->link_off : topo->port_off;
+    netdev_item_t **edges = dir == NETDEV_TOPO_UPPER ? topo->links : topo->ports;
+
+    if (topo_push(topo, &stack, &len, &cap, one, f.depth + 1)) goto nomem;
+    for (uint32_t e = off[f.id]; e < off[f.id + 1]; e++) {
+      if (topo_push(topo, &stack, &len, &cap, edges[e], f.depth + 1)) goto nomem;
+    }
+  }
+  free(stack);
+  return ret;
+
+nomem:
+  free(stack);
+  errno = ENOMEM;
+  return -1;
+}
@@ -0,0 +1,49 @@
+#ifndef NETLINK_GET_ADDR_TOPO_H
+#define NETLINK_GET_ADDR_TOPO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "libnl_getlink.h"
+
+/* stack walk direction, upper: master and devices linked on top (vlan on eth0),
+ * lower: ports and the IFLA_LINK parent */
+typedef enum netdev_topo_dir {
+  NETDEV_TOPO_UPPER,
+  NETDEV_TOPO_LOWER,
+} netdev_topo_dir_t;
+
+/* link graph of one table snapshot, relations are kept CSR style: the
+ * children of device id i are edges[off[i]] .. edges[off[i + 1] - 1] */
+typedef struct netdev_topo {
+  size_t count;
+  netdev_item_t **devs;     /* dense id -> device */
+  netdev_item_t **master;   /* dense id -> master device or NULL */
+  netdev_item_t **lower;    /* dense id -> IFLA_LINK device or NULL */
+  uint32_t *port_off;       /* count + 1 offsets into ports */
+  netdev_item_t **ports;    /* enslaved devices grouped by master */
+  uint32_t *link_off;       /* count + 1 offsets into links */
+  netdev_item_t **links;    /* devices grouped by their IFLA_LINK device */
+  int *keys;                /* open addressing ifindex -> dense id */
+  uint32_t *ids;
+  size_t mask;
+  uint32_t *marks;          /* walk visit stamps */
+  uint32_t epoch;
+} netdev_topo_t;
+
+/* walk callback, depth is 0 for the start device, nonzero return stops */
+typedef int (*netdev_topo_cb)(const netdev_item_t *dev, unsigned int depth, void *arg);
+
+/* the topology points into the table, rebuild it after each dump or change */
+int netdev_topo_build(netdev_topo_t *topo, netdev_table_t *table);
+void netdev_topo_free(netdev_topo_t *topo);
+netdev_item_t *netdev_topo_get(const netdev_topo_t *topo, int index);
+netdev_item_t *netdev_topo_master(const netdev_topo_t *topo, int index);
+netdev_item_t *netdev_topo_lower(const netdev_topo_t *topo, int index);
+netdev_item_t *const *netdev_topo_ports(const netdev_topo_t *topo, int master, size_t *n);
+netdev_item_t *const *netdev_topo_links(const netdev_topo_t *topo, int index, size_t *n);
+/* depth first, every device once even with veth peers linking each other.
+ * Walks on one topology must not run concurrently. */
+int netdev_topo_walk(netdev_topo_t *topo, int index, netdev_topo_dir_t dir, netdev_topo_cb cb, void *arg);
+
+#endif // NETLINK_GET_ADDR_TOPO_H